@@ -8,6 +8,8 @@ workspace "AI"
 		buildoptions {"-std=c11 -pedantic -Wall"}
 	filter "system:windows"
 		links {"mingw32"}
+	filter "system:linux"
+		links {"pthread"}
 	filter "configurations:Debug"
 		defines {"DEBUG"}
 		symbols "On"
@@ -28,7 +30,7 @@ workspace "AI"
 			"src/**.h",
 			"src/**.c",
 		}
-		removefiles "src/main.c"
+		removefiles {"src/main.c", "src/replay.c"}
 		filter {}
 	--Tests
 	project "test"
@@ -38,3 +40,11 @@ workspace "AI"
 		files "src/main.c"
 		links {"kernel"}
 		filter {}
+	--Replays traces of solves
+	project "replay"
+		language "C"
+		kind "ConsoleApp"
+		includedirs "include"
+		files "src/replay.c"
+		links {"kernel"}
+		filter {}
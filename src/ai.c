@@ -1,6 +1,7 @@
 #include "local.h"
 
 AI_state *_ai;
+AI_SHARED AI_stats _stats;
 
 AI_NORETURN int
 ai_throw (uint32_t error)
@@ -15,6 +16,11 @@ ai_alloc (void *ptr, size_t size)
 	if (NULL == p) ai_throw (AI_ERR_NOMEM);
 	return p;
 }
+void *
+ai_try_alloc (void *ptr, size_t size)
+{	/*For threads that must not throw, ptr is left alone on failure*/
+	return _ai->mem.realloc (ptr, size);
+}
 void
 ai_free (void *ptr)
 {
@@ -53,8 +59,19 @@ ai_atpanic (AI_panic panic)
 	_ai->panic = panic;
 }
 void
-ai_shutdown (void)
+ai_stats_get (AI_stats *stats)
 {
+	*stats = _stats;
+}
+void
+ai_stats_reset (void)
+{
+	memset (&_stats, 0, sizeof (_stats));
+}
+void
+ai_shutdown (void)
+{	/*Only the cache of the calling thread can be reached from here*/
+	ai_mind_cache_flush ();
 	_ai->mem.free (_ai->actions);
 	_ai->mem.free (_ai);
 	_ai = NULL;
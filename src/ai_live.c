@@ -0,0 +1,81 @@
+#include "local.h"
+
+struct _AI_live
+{
+	AI_mind *_Atomic current;
+	_Atomic uint32_t epoch;
+	_Atomic uint32_t pins[2]; /*Readers inside each parity of epoch*/
+};
+
+/*Readers pin the parity of the epoch they enter in for just long enough to
+take a reference on the current revision. A writer swaps in the new revision,
+flips the epoch and waits for the readers pinned on the old parity to leave,
+after which nobody can still be about to take a reference on the old one*/
+static uint32_t
+live_pin (AI_live *self)
+{
+	while (1)
+	{
+		uint32_t epoch = atomic_load (&self->epoch);
+		atomic_fetch_add (&self->pins[epoch&1], 1);
+		if (epoch == atomic_load (&self->epoch))
+		{
+			return epoch;
+		}
+		/*A writer flipped the epoch under us, try again on the new one*/
+		atomic_fetch_sub (&self->pins[epoch&1], 1);
+	}
+}
+static void
+live_unpin (AI_live *self, uint32_t epoch)
+{
+	atomic_fetch_sub_explicit (&self->pins[epoch&1], 1, memory_order_release);
+}
+static void
+live_synchronise (AI_live *self)
+{
+	uint32_t epoch = atomic_fetch_add (&self->epoch, 1);
+	while (atomic_load (&self->pins[epoch&1]))
+	{
+		/*Readers hold their pin for a handful of instructions*/
+	}
+}
+AI_live *
+ai_live_create (AI_mind *mind)
+{	/*Takes over the reference held by the caller*/
+	AI_live *self = ai_alloc (NULL, sizeof (*self));
+	atomic_init (&self->current, mind);
+	atomic_init (&self->epoch, 0);
+	atomic_init (&self->pins[0], 0);
+	atomic_init (&self->pins[1], 0);
+	return self;
+}
+void
+ai_live_destroy (AI_live *self)
+{	/*Revisions still held elsewhere outlive this*/
+	ai_mind_destroy (atomic_load (&self->current));
+	ai_free (self);
+}
+AI_mind *
+ai_live_acquire (AI_live *self)
+{	/*The caller owns a reference to the returned revision*/
+	uint32_t epoch = live_pin (self);
+	AI_mind *mind = ai_mind_retain (atomic_load (&self->current));
+	live_unpin (self, epoch);
+	return mind;
+}
+AI_mind *
+ai_live_edit (AI_live *self)
+{
+	AI_mind *current = ai_live_acquire (self);
+	AI_mind *mind = ai_mind_clone (current);
+	ai_mind_release (current);
+	return mind;
+}
+void
+ai_live_publish (AI_live *self, AI_mind *mind)
+{	/*Takes over the reference held by the caller*/
+	AI_mind *old = atomic_exchange (&self->current, mind);
+	live_synchronise (self);
+	ai_mind_destroy (old);
+}
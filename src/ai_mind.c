@@ -1,17 +1,155 @@
 #include "local.h"
 
+/*Serials are handed out to every revision of every mind, so a cached plan
+can never be mistaken for one of a different or since modified mind*/
+static _Atomic uint32_t _serial = 1;
+
+#if AI_PLAN_CACHE > 0
+/*Bodies hold no reference to their mind, so entries keep a revision of the
+mind alive no longer than the plans solved with it do*/
+typedef struct _AI_cached
+{
+	uint32_t serial; /*Zero when the entry is empty*/
+	uint32_t result;
+	AI_conds world; /*Enabled too, as macros are refined from it*/
+	AI_conds goal;
+	AI_plan_body *body;
+}AI_cached;
+AI_SHARED AI_cached _cache[AI_PLAN_CACHE];
+
+static AI_cached *
+cache_entry (uint32_t serial, AI_conds world, AI_conds goal)
+{	/*Mix the key down into a slot*/
+	uint64_t h = serial;
+	h = h*0x9e3779b97f4a7c15ull ^ (uint64_t)world.state;
+	h = h*0x9e3779b97f4a7c15ull ^ (uint64_t)world.enabled;
+	h = h*0x9e3779b97f4a7c15ull ^ (uint64_t)(goal.state&goal.enabled);
+	h = h*0x9e3779b97f4a7c15ull ^ (uint64_t)goal.enabled;
+	h ^= h>>29;
+	return &_cache[h%AI_PLAN_CACHE];
+}
+static bool
+cache_match (AI_cached *c, uint32_t serial, AI_conds world, AI_conds goal)
+{
+	return c->serial == serial
+		&& c->world.state == world.state
+		&& c->world.enabled == world.enabled
+		&& c->goal.enabled == goal.enabled
+		&& ai_conds_compare (&c->goal, &goal, goal.enabled);
+}
+static void
+cache_evict (AI_cached *c)
+{
+	ai_plan_body_release (c->body);
+	memset (c, 0, sizeof (*c));
+}
+#endif
+/*Relevant actions of a search, grown to fit the largest mind solved*/
+AI_SHARED uint32_t *_relevant;
+AI_SHARED size_t _nrelevant;
+
+/*Minds are allocated with their reference count behind them, which keeps the
+atomic out of the public header*/
+typedef struct _AI_mind_shared
+{
+	AI_mind mind;
+	_Atomic uint32_t refs;
+}AI_mind_shared;
+
+static _Atomic uint32_t *
+mind_refs (AI_mind *self)
+{
+	return &((AI_mind_shared *)self)->refs;
+}
+static void
+mind_touch (AI_mind *self)
+{
+	self->serial = atomic_fetch_add (&_serial, 1);
+}
 AI_mind *
 ai_mind_create (void)
 {
-	AI_mind *self = ai_alloc (NULL, sizeof (*self));
+	AI_mind *self = ai_alloc (NULL, sizeof (AI_mind_shared));
 	memset (self, 0, sizeof (*self));
+	atomic_init (mind_refs (self), 1);
+#ifdef AI_USE_REACHABILITY
+	ai_reach_reset (self);
+#endif
+	mind_touch (self);
+	return self;
+}
+AI_mind *
+ai_mind_clone (AI_mind *self)
+{	/*The copy is private to the caller until it is published*/
+	AI_mind *mind = ai_alloc (NULL, sizeof (AI_mind_shared));
+	memcpy (mind, self, sizeof (*mind));
+	atomic_init (mind_refs (mind), 1);
+	mind->actions = NULL;
+	if (self->nactions)
+	{
+		size_t size = self->nactions*sizeof (AI_action);
+		mind->actions = ai_alloc (NULL, size);
+		memcpy (mind->actions, self->actions, size);
+	}
+	for (uint32_t i = 0; i < mind->nactions; i++)
+	{
+		ai_mind_retain (mind->actions[i].sub);
+	}
+	if (self->reach)
+	{
+		mind->reach = ai_alloc (NULL, sizeof (AI_reach));
+		memcpy (mind->reach, self->reach, sizeof (AI_reach));
+	}
+	mind_touch (mind);
+	return mind;
+}
+AI_mind *
+ai_mind_retain (AI_mind *self)
+{
+	if (self)
+	{
+		atomic_fetch_add_explicit (mind_refs (self), 1, memory_order_relaxed);
+	}
 	return self;
 }
 void
-ai_mind_destroy (AI_mind *self)
+ai_mind_release (AI_mind *self)
 {
+	if (NULL == self)
+	{
+		return;
+	}
+	if (1 != atomic_fetch_sub_explicit (mind_refs (self), 1, memory_order_acq_rel))
+	{
+		return;
+	}
+	for (uint32_t i = 0; i < self->nactions; i++)
+	{
+		ai_mind_release (self->actions[i].sub);
+	}
+	ai_free (self->actions);
+	ai_free (self->reach);
 	ai_free (self);
 }
+void
+ai_mind_destroy (AI_mind *self)
+{
+	ai_mind_release (self);
+}
+void
+ai_mind_cache_flush (void)
+{	/*Also lets go of the scratch of the thread*/
+	ai_free (_relevant);
+	_relevant = NULL;
+	_nrelevant = 0;
+	ai_plan_scratch_release ();
+#if AI_PLAN_CACHE > 0
+	for (uint32_t i = 0; i < AI_PLAN_CACHE; i++)
+	{
+		cache_evict (&_cache[i]);
+	}
+#endif
+}
 static bool
 condition_find (AI_mind *self, const char *atom, uint32_t *index)
 {
@@ -33,7 +171,7 @@ ai_mind_condition_get (AI_mind *self, const char *atom)
 	uint32_t index = 0;
 	if (condition_find (self, atom, &index))
 	{
-		return 1<<index;
+		return (AI_condition)1<<index;
 	}
 	return AI_INVALID;
 }
@@ -43,7 +181,7 @@ ai_mind_condition_add (AI_mind *self, const char *atom)
 	uint32_t index = 0;
 	if (condition_find (self, atom, &index))
 	{
-		return 1<<index;
+		return (AI_condition)1<<index;
 	}
 	if (AI_MAX_CONDITIONS <= self->nconds)
 	{
@@ -52,9 +190,28 @@ ai_mind_condition_add (AI_mind *self, const char *atom)
 	index = self->nconds;
 	self->conds[index] = atom;
 	self->nconds++;
-	return 1<<index;
+	return (AI_condition)1<<index;
 }
-AI_action *
+/*Maps conditions given in the bits of mind from onto the bits of this mind.
+Conditions unknown to either mind are left out*/
+AI_conds
+ai_mind_conds_translate (AI_mind *self, AI_mind *from, AI_conds conds)
+{
+	AI_conds out;
+	ai_conds_clear (&out);
+	for (uint32_t i = 0; i < from->nconds; i++)
+	{
+		AI_condition b = (AI_condition)1<<i;
+		uint32_t index = 0;
+		if (!(conds.enabled&b) || !condition_find (self, from->conds[i], &index))
+		{
+			continue;
+		}
+		ai_conds_write (&out, (AI_condition)1<<index, conds.state&b);
+	}
+	return out;
+}
+const AI_action *
 ai_mind_action_get (AI_mind *self, uint32_t index)
 {
 	if (self->nactions <= index)
@@ -64,11 +221,125 @@ ai_mind_action_get (AI_mind *self, uint32_t index)
 	return &self->actions[index];
 }
 void
+ai_mind_action_set (AI_mind *self, uint32_t index, AI_action *action)
+{
+	if (self->nactions <= index)
+	{
+		return;
+	}
+	AI_action *act = &self->actions[index];
+	ai_mind_retain (action->sub);
+	ai_mind_release (act->sub);
+	if (act->precondition || act->evaluate) self->ncallbacks--;
+	*act = *action;
+	if (act->precondition || act->evaluate) self->ncallbacks++;
+#ifdef AI_USE_REACHABILITY
+	/*Pairs the old action broke may hold together again*/
+	ai_reach_reset (self);
+#endif
+	mind_touch (self);
+}
+void
 ai_mind_action_add (AI_mind *self, AI_action *action)
 {	/*Allocate space for the new action and copy it*/
 	uint32_t index = self->nactions++;
 	self->actions = ai_alloc (self->actions, self->nactions*sizeof (*action));
 	self->actions[index] = *action;
+	ai_mind_retain (action->sub);
+#ifdef AI_USE_REACHABILITY
+	ai_reach_add (self, action);
+#endif
+	if (action->precondition || action->evaluate) self->ncallbacks++;
+	mind_touch (self);
+}
+
+/*Checks whether a makes b redundant: a can be taken whenever b can, costs no
+more, and leaves the world exactly as b would*/
+static bool
+action_dominates (AI_action *a, AI_action *b)
+{
+	if (a->evaluate || b->cost < a->cost)
+	{
+		return false;
+	}
+	/*A precondition may depend on the action it is asked about, so sharing
+	one says nothing about how it answers for b*/
+	if (a->precondition)
+	{
+		return false;
+	}
+	/*The entry of a must be implied by the entry of b*/
+	AI_condition en = a->entry.enabled;
+	if ((en&b->entry.enabled) != en)
+	{
+		return false;
+	}
+	if ((a->entry.state^b->entry.state)&en)
+	{
+		return false;
+	}
+	/*Where only one of them writes a condition, the write must be one b's
+	entry guarantees is a no-op*/
+	AI_condition both = a->exit.enabled&b->exit.enabled;
+	if ((a->exit.state^b->exit.state)&both)
+	{
+		return false;
+	}
+	AI_condition fixed = b->entry.enabled;
+	AI_condition only = (a->exit.enabled^b->exit.enabled);
+	if ((only&fixed) != only)
+	{
+		return false;
+	}
+	AI_condition exit = (a->exit.state&a->exit.enabled)
+		|(b->exit.state&b->exit.enabled);
+	return !((exit^b->entry.state)&only);
+}
+uint32_t
+ai_mind_optimize (AI_mind *self)
+{	/*Mark every action dominated by another. Of two equivalent actions the
+	first one added is kept*/
+	bool *dominated = ai_alloc (NULL, self->nactions*sizeof (bool) + 1);
+	for (uint32_t i = 0; i < self->nactions; i++)
+	{
+		AI_action *b = self->actions + i;
+		dominated[i] = false;
+		for (uint32_t j = 0; j < self->nactions && !dominated[i]; j++)
+		{
+			AI_action *a = self->actions + j;
+			if (i == j || !action_dominates (a, b))
+			{
+				continue;
+			}
+			dominated[i] = (j < i) || !action_dominates (b, a);
+		}
+	}
+	/*Compact the survivors*/
+	uint32_t n = 0;
+	for (uint32_t i = 0; i < self->nactions; i++)
+	{
+		if (!dominated[i])
+		{
+			self->actions[n++] = self->actions[i];
+		}
+		else
+		{
+			AI_action *act = self->actions + i;
+			if (act->precondition || act->evaluate) self->ncallbacks--;
+			ai_mind_release (act->sub);
+		}
+	}
+	ai_free (dominated);
+	uint32_t removed = self->nactions - n;
+	self->nactions = n;
+	if (removed)
+	{
+#ifdef AI_USE_REACHABILITY
+		ai_reach_reset (self);
+#endif
+		mind_touch (self);
+	}
+	return removed;
 }
 
 /*TODO: these should be dynamic, but TLS complicates things a bit
@@ -77,27 +348,50 @@ pass it to relevant functions and forego TLS all together. Could allocate
 node memory from a special global allocator and clean up that way too.*/
 AI_SHARED uint32_t _nnodes;
 AI_SHARED AI_node _nodes[AI_MAX_NODES];
-AI_SHARED uint32_t _nopened;
-AI_SHARED AI_handle _opened[AI_MAX_NODES];
-AI_SHARED uint32_t _nclosed;
-AI_SHARED AI_handle _closed[AI_MAX_NODES];
+AI_SHARED AI_node *_set[AI_MAX_NODES];
+AI_SHARED AI_queue _opened;
+AI_SHARED AI_memo _memo;
 
-/*Returns the number of unset bits between start and goal. This is analogous
-to computing the linear distance between two points*/
-static uint32_t
-heuristic (AI_conds start, AI_conds goal)
-{
-	AI_condition x = (start.state&goal.enabled);
-	AI_condition y = (goal.state&goal.enabled);
-	AI_condition delta = x^y;
-	uint32_t n = AI_MAX_CONDITIONS;
-	while (delta)
+void
+ai_memo_clear (AI_memo *self)
+{	/*Stamps only need clearing when they wrap around*/
+	if (0 == ++self->stamp)
 	{
-		delta >>= 1;
-		n--;
+		memset (self->entries, 0, sizeof (self->entries));
+		self->stamp = 1;
 	}
-	return n;
 }
+uint32_t
+ai_memo_cost (
+	AI_memo *self,
+	AI_mind *mind,
+	uint32_t index,
+	AI_conds *cond,
+	void *user,
+	AI_stats *stats
+){
+	AI_action *act = mind->actions + index;
+	AI_condition key = cond->state&act->evaluated;
+	uint64_t h = ((uint64_t)key ^ ((uint64_t)index<<32))*0x9e3779b97f4a7c15ull;
+	AI_memo_entry *e = &self->entries[(h>>40)&(AI_COST_MEMO - 1)];
+	if (e->stamp == self->stamp && e->act == index && e->key == key)
+	{
+		return e->cost;
+	}
+	/*Never undercut the declared bound, the heuristic relies on it*/
+	uint32_t cost = act->evaluate (act, cond, user);
+	if (cost < act->cost) cost = act->cost;
+	stats->evaluated++;
+#ifdef AI_USE_TRACE
+	if (_trace.open) ai_trace_cost (index, key, cost);
+#endif
+	e->stamp = self->stamp;
+	e->act = index;
+	e->key = key;
+	e->cost = cost;
+	return cost;
+}
+
 static AI_node *
 node_alloc (void)
 {
@@ -107,168 +401,130 @@ node_alloc (void)
 		ai_throw (AI_ERR_MAXNODES);
 	}
 	n = _nodes + _nnodes++;
+	_stats.generated++;
 	return n;
 }
-static uint32_t
-node_find (AI_handle *set, uint32_t num, AI_conds cond)
+/*Every node ever visited is either opened or closed, so searching the node
+storage covers both sets in a single pass*/
+static AI_node *
+node_find (AI_conds cond)
 {
-#ifdef AI_USE_MIN_HEAP
-	for (uint32_t i = 0; i < num; i++)
-#else
-	for (uint32_t i = 0; i < num; i++)
-#endif
+	for (uint32_t i = 0; i < _nnodes; i++)
 	{
-		if (!ai_conds_compare (&_nodes[set[i]].cond, &cond, ~0)) continue;
-		return i;
+		if (!ai_conds_compare (&_nodes[i].cond, &cond, ~0)) continue;
+		return &_nodes[i];
 	}
-	return AI_INVALID;
+	return NULL;
 }
-static void
-node_insert (AI_handle *set, uint32_t *num, AI_node *node)
+/*Collects the actions that may help reach goal into list, working backward
+from the goal's conditions to the actions achieving them and on to their 
+entries. Actions achieving none of these can be left out of any plan, as 
+dropping them from a plan never stops it from reaching the goal. Neither can
+actions whose entry is never reachable from the world be of any use*/
+uint32_t
+ai_mind_relevant (AI_mind *self, AI_conds world, AI_conds goal, uint32_t *list)
 {
-#ifdef AI_USE_MIN_HEAP
-	uint32_t len = *num;
-	/*Climb the parents and swap them to maintain the heap as needed*/
-	set[len] = (AI_handle)((ptrdiff_t)(node - _nodes));
-	uint32_t n = ++len;
-	while (n)
-	{
-		uint32_t p = (--n)>>1;
-		if (_nodes[set[n]].f < _nodes[set[p]].f)
-		{
-			uint32_t swap = set[n];
-			set[n] = set[p];
-			set[p] = swap;
-			n = p;
-		}
-		else break;
+	uint32_t n = 0;
+#ifdef AI_USE_REACHABILITY
+	for (uint32_t i = 0; i < self->nactions; i++)
+	{
+		if (ai_reach_possible (self, world, self->actions[i].entry)) list[n++] = i;
 	}
-	*num = len;
 #else
-	uint32_t len = *num;
-	set[len++] = (AI_handle)((ptrdiff_t)(node - _nodes));
-	*num = len;
+	(void)world;
+	for (uint32_t i = 0; i < self->nactions; i++)
+	{
+		list[n++] = i;
+	}
 #endif
-}
-static void
-node_remove (AI_handle *set, uint32_t *num, AI_node *node)
-{
-#ifdef AI_USE_MIN_HEAP
-	/*Move last element into the root position and sift down to restore
-	the min heap invariant*/
-	uint32_t len = *num;
-	set[0] = set[--len];
-	uint32_t i = 0;
-	while (1)
-	{
-		uint32_t min = i;
-		uint32_t l = (i<<1) + 1;
-		uint32_t r = (i<<1) + 2;
-		if (l < len && _nodes[set[l]].f < _nodes[set[min]].f) min = l;
-		if (r < len && _nodes[set[r]].f < _nodes[set[min]].f) min = r;
-		if (min != i)
+#ifdef AI_USE_RELEVANCE
+	bool *marked = (bool *)(list + self->nactions);
+	AI_condition pos = goal.state&goal.enabled;
+	AI_condition neg = ~goal.state&goal.enabled;
+	memset (marked, 0, n*sizeof (*marked));
+	bool changed = true;
+	while (changed)
+	{
+		changed = false;
+		for (uint32_t i = 0; i < n; i++)
 		{
-			uint32_t swap = set[min];
-			set[min] = set[i];
-			set[i] = swap;
-			i = min;
+			AI_action *act = self->actions + list[i];
+			AI_condition set = act->exit.state&act->exit.enabled;
+			AI_condition unset = ~act->exit.state&act->exit.enabled;
+			if (marked[i] || !((set&pos)|(unset&neg)))
+			{
+				continue;
+			}
+			marked[i] = true;
+			pos |= act->entry.state&act->entry.enabled;
+			neg |= ~act->entry.state&act->entry.enabled;
+			/*Changing what an action is priced by in either way may make it
+			cheaper, which helps as much as a condition it needs*/
+			if (act->evaluate)
+			{
+				pos |= act->evaluated;
+				neg |= act->evaluated;
+			}
+			changed = true;
 		}
-		else break;
 	}
-#else
-	uint32_t len = *num;
-	uint32_t ndx = node_find (set, len, node->cond);
-	if (AI_INVALID == ndx)
+	uint32_t kept = 0;
+	for (uint32_t i = 0; i < n; i++)
 	{
-		return;
+		if (marked[i]) list[kept++] = list[i];
 	}
-	/*Remove from the set*/
-	set[ndx] = set[--len];
-	*num = len;
+	n = kept;
 #endif
+	return n;
 }
-static AI_node *
-node_min (AI_handle *set, uint32_t *num)
+/*Runs A* from world until a node satisfying goal is taken from the open 
+list, which is returned. NULL is returned when no path exists*/
+AI_node *
+ai_mind_search (AI_mind *self, AI_conds world, AI_conds goal, void *user)
 {
-#ifdef AI_USE_MIN_HEAP
-	return &_nodes[set[0]];
-#else
-	/*Scan for the lowest cost element*/
-	uint32_t len = *num;
-	uint32_t best = UINT32_MAX;
-	AI_node *ret = NULL;
-	for (uint32_t i = 0; i < len; i++)
-	{
-		AI_node *n = &_nodes[set[i]];
-		uint32_t f = n->f;
-		if (f < best)
-		{
-			best = f;
-			ret = n;
-		}
+	AI_node *root = NULL;
+	AI_node *found = NULL;
+	_stats.solves++;
+#ifdef AI_USE_REACHABILITY
+	/*Give up straight away on goals that can never hold together*/
+	if (!ai_reach_possible (self, world, goal))
+	{
+		_stats.rejected++;
+		return NULL;
 	}
-	return ret;
 #endif
-}
-uint32_t
-ai_mind_solve (
-	AI_mind *self,
-	AI_plan *plan,
-	AI_conds world,
-	AI_conds goal,
-	void *user
-){	
-	AI_node *root = NULL;
-	/*Ensure there is actual work to do*/
-	if (ai_conds_compare (&world, &goal, goal.enabled))
+	/*Narrow down the actions to those relevant to the goal*/
+	if (_nrelevant < AI_RELEVANT_SIZE (self))
 	{
-		plan->mind = self;
-		plan->head = 0;
-		plan->used = 0;
-		return 0;
+		_relevant = ai_alloc (_relevant, AI_RELEVANT_SIZE (self));
+		_nrelevant = AI_RELEVANT_SIZE (self);
 	}
+	uint32_t *relevant = _relevant;
+	uint32_t nrelevant = ai_mind_relevant (self, world, goal, relevant);
 	/*Clear the node state*/
 	_nnodes = 0;
-	_nopened = 0;
-	_nclosed = 0;
+	ai_memo_clear (&_memo);
+	ai_queue_init (&_opened, _set, AI_MAX_NODES);
 	/*Add initial node and begin solving*/
 	root = node_alloc ();
 	root->parent = NULL;
 	root->cond = world;
 	root->act = AI_INVALID;
 	root->g = 0;
-	root->f = heuristic (world, goal);	
-	node_insert (_opened, &_nopened, root);
-	while (_nopened != 0)
+	root->f = ai_heuristic (world, goal);	
+	ai_queue_push (&_opened, root);
+	while (!ai_queue_empty (&_opened))
 	{
-		AI_node *n = node_min (_opened, &_nopened);
+		AI_node *n = ai_queue_pop (&_opened);
+		_stats.expanded++;
+		_stats.considered += nrelevant;
+		_stats.pruned += self->nactions - nrelevant;
 		/*Have we reached the goal?*/
 		if (ai_conds_compare (&n->cond, &goal, goal.enabled))
-		{/*Walk backward to the goal, adding each action into the plan
-		as we go. NB: No attempt to reverse the order is made here, instead
-		when executing the plan we read it backward. simple, right?*/ 
-			AI_node *node = n;
-			uint32_t i = 0;
-			do
-			{/*Ensure there is space for each addition, growing as needed*/
-				if (plan->nacts <= i)
-				{
-					const size_t size = sizeof (plan->acts[0]);
-					uint32_t nacts = plan->nacts + AI_PLAN_GRANULARITY;
-					plan->acts = ai_alloc (plan->acts, size*nacts);
-					plan->nacts = nacts;
-				}
-				plan->acts[i++] = (AI_handle)node->act;
-				node = node->parent;
-			}
-			while (node->parent != NULL);
-			plan->mind = self;
-			plan->head = i;
-			plan->used = i;
-			return n->f;
+		{
+			found = n;
+			break;
 		}
-		node_remove (_opened, &_nopened, n);
-		node_insert (_closed, &_nclosed, n);
 		/*Check all edges from this node...
 		There are two ways of interpretting this:
 		
@@ -281,8 +537,9 @@ ai_mind_solve (
 		can become large and maintaining explicit edges from all nodes is
 		insane. If assuming 2., then the state becomes more manageable and
 		this can be rewritten to possibly be more efficient*/
-		for (uint32_t i = 0; i < self->nactions; i++)
+		for (uint32_t j = 0; j < nrelevant; j++)
 		{
+			uint32_t i = relevant[j];
 			AI_action *act = self->actions + i;
 			/*Is this action a connecting edge?*/
 			if (!ai_conds_compare (
@@ -291,47 +548,144 @@ ai_mind_solve (
 				continue;
 			}
 			/*Ensure this action is possible*/
-			if (act->precondition && !act->precondition (act, user))
+			if (!ai_action_possible (act, i, user))
 			{
 				continue;
 			}
 			uint32_t cost = n->g + act->cost;
-			AI_conds entry = ai_conds_merge (&n->cond, &act->exit);
-			/*Find the neighbour
-			We have to search the closed and opened sets for this. Bummer.*/
-			AI_node *node = NULL;
-			uint32_t next = node_find (_opened, _nopened, entry);
-			if (AI_INVALID != next) node = &_nodes[_opened[next]];
-			else
+			if (act->evaluate)
 			{
-				next = node_find (_closed, _nclosed, entry);
-				if (AI_INVALID != next) node = &_nodes[_closed[next]];
-				else
-				{/*This node hasn't been visited before*/
-					node = node_alloc ();
-					node->act = i;
-					
-					node->cond = entry;
-					node->parent = n;
-					node->g = cost;
-					node->f = cost + heuristic (entry, goal);
-					
-					node_insert (_opened, &_nopened, node);
-					continue;
-				}
+				cost = n->g + ai_memo_cost (
+					&_memo, self, i, &n->cond, user, &_stats);
 			}
-			/*Take this node if it yields a cheaper path*/
+			AI_conds entry = ai_conds_merge (&n->cond, &act->exit);
+			/*Find the neighbour*/
+			AI_node *node = node_find (entry);
+			if (NULL == node)
+			{/*This node hasn't been visited before*/
+				node = node_alloc ();
+				node->act = i;
+				
+				node->cond = entry;
+				node->parent = n;
+				node->g = cost;
+				node->f = cost + ai_heuristic (entry, goal);
+				
+				ai_queue_push (&_opened, node);
+				continue;
+			}
+			/*Take this node if it yields a cheaper path. Queued nodes are
+			sifted into their new place, closed ones are opened again so the
+			cheaper path propagates to their successors*/
 			if (cost < node->g)
 			{
-				node->cond = entry;
+				node->act = i;
 				node->parent = n;
 				node->g = cost;
-				node->f = cost + heuristic (entry, goal);
-				node = NULL;
+				node->f = cost + ai_heuristic (entry, goal);
+				_stats.improved++;
+				if (ai_queue_contains (&_opened, node))
+				{
+					ai_queue_update (&_opened, node);
+				}
+				else ai_queue_push (&_opened, node);
 			}
 		}
 	}
-	/*No possible path*/
-	return AI_INVALID;
+	/*Found stays NULL when there is no possible path*/
+	return found;
 }
 
+
+/*Walk backward to the goal, adding each action into the body as we go. 
+NB: No attempt to reverse the order is made here, instead when executing the
+plan we read it backward. simple, right?*/
+AI_plan_body *
+ai_mind_body_build (AI_conds conds, AI_node *goal)
+{
+	uint32_t used = 0;
+	AI_node *root = goal;
+	for (; root->parent != NULL; root = root->parent)
+	{
+		used++;
+	}
+	AI_plan_body *body = ai_plan_body_create (root->cond, conds, used);
+	uint32_t i = 0;
+	for (AI_node *node = goal; node->parent != NULL; node = node->parent)
+	{
+		body->acts[i++] = (AI_handle)node->act;
+	}
+	return body;
+}
+static uint32_t
+mind_solve (
+	AI_mind *self,
+	AI_plan *plan,
+	AI_conds world,
+	AI_conds goal,
+	void *user
+){	
+	/*Ensure there is actual work to do*/
+	if (ai_conds_compare (&world, &goal, goal.enabled))
+	{
+		ai_plan_assign (plan, self, ai_plan_body_create (world, goal, 0));
+		return 0;
+	}
+#if AI_PLAN_CACHE > 0
+	/*Answer from the cache when the outcome can't depend on the user*/
+	AI_cached *c = NULL;
+	if (!self->ncallbacks)
+	{
+		c = cache_entry (self->serial, world, goal);
+		if (cache_match (c, self->serial, world, goal))
+		{
+			_stats.cached++;
+			if (AI_INVALID != c->result)
+			{
+				ai_plan_assign (plan, self, ai_plan_body_retain (c->body));
+			}
+			return c->result;
+		}
+	}
+#endif
+	uint32_t result = AI_INVALID;
+	AI_plan_body *body = NULL;
+	AI_node *n = ai_mind_search (self, world, goal, user);
+	if (n)
+	{
+		body = ai_mind_body_build (goal, n);
+		result = n->f;
+		ai_plan_assign (plan, self, body);
+	}
+#if AI_PLAN_CACHE > 0
+	if (c)
+	{
+		cache_evict (c);
+		c->serial = self->serial;
+		c->result = result;
+		c->world = world;
+		c->goal = goal;
+		c->body = ai_plan_body_retain (body);
+	}
+#endif
+	return result;
+}
+uint32_t
+ai_mind_solve (
+	AI_mind *self,
+	AI_plan *plan,
+	AI_conds world,
+	AI_conds goal,
+	void *user
+){
+#ifdef AI_USE_TRACE
+	if (_trace.sink)
+	{
+		ai_trace_begin (self, world, goal);
+		uint32_t result = mind_solve (self, plan, world, goal, user);
+		ai_trace_end (self, plan, result);
+		return result;
+	}
+#endif
+	return mind_solve (self, plan, world, goal, user);
+}
@@ -0,0 +1,533 @@
+#include "local.h"
+
+#ifdef AI_USE_THREADS
+#include <threads.h>
+
+/*Hash distributed A*. Every state is owned by exactly one worker, chosen by
+hashing its conditions. Workers expand the nodes they own and send generated
+nodes to their owners through lock-free inboxes, so duplicate detection never
+needs to be shared between threads*/
+typedef struct _AI_message
+{
+	AI_node *parent;
+	AI_conds cond;
+	uint32_t g;
+	uint32_t act;
+}AI_message;
+typedef struct _AI_batch
+{
+	struct _AI_batch *next;
+	uint32_t n;
+	AI_message msgs[AI_PARALLEL_BATCH];
+}AI_batch;
+typedef struct _AI_worker
+{
+	struct _AI_parallel *search;
+	thrd_t thread;
+	uint32_t id;
+	/*Batches sent to this worker, pushed by anyone and taken all at once*/
+	_Atomic (AI_batch *) inbox;
+	/*Lowest f this worker may still expand, for the termination check*/
+	_Atomic uint32_t min;
+	AI_batch *outbox[AI_MAX_WORKERS];
+	uint32_t pending; /*Messages held in the outboxes*/
+	AI_queue opened;
+	/*Owned nodes, kept in chunks that never move and hashed by state*/
+	uint32_t nchunks, used;
+	AI_node **chunks;
+	uint32_t ntable, ncap;
+	AI_node **table;
+	AI_node *goal;
+	AI_stats stats;
+	AI_memo memo;
+}AI_worker;
+typedef struct _AI_parallel
+{
+	AI_mind *mind;
+	AI_conds goal;
+	void *user;
+	uint32_t nrelevant;
+	uint32_t *relevant;
+	uint32_t nworkers;
+	/*Cost of the best goal found so far*/
+	_Atomic uint32_t incumbent;
+	/*Batches sent and batches fully received, across all workers*/
+	_Atomic uint64_t sent;
+	_Atomic uint64_t received;
+	_Atomic uint32_t nnodes;
+	_Atomic bool done;
+	_Atomic uint32_t error; /*Thrown by the caller once everyone stops*/
+	AI_worker workers[AI_MAX_WORKERS];
+}AI_parallel;
+
+static uint64_t
+conds_hash (AI_condition state)
+{
+	uint64_t h = (uint64_t)state + 0x9e3779b97f4a7c15ull;
+	h = (h^(h>>30))*0xbf58476d1ce4e5b9ull;
+	h = (h^(h>>27))*0x94d049bb133111ebull;
+	return h^(h>>31);
+}
+static uint32_t
+conds_owner (AI_parallel *ps, AI_condition state)
+{
+	return (uint32_t)((conds_hash (state)>>32)%ps->nworkers);
+}
+/*Workers can't throw, so running out of nodes or memory stops everyone and
+leaves the error for the caller to throw*/
+static void
+worker_fail (AI_worker *self, uint32_t error)
+{
+	AI_parallel *ps = self->search;
+	uint32_t none = 0;
+	atomic_compare_exchange_strong (&ps->error, &none, error);
+	atomic_store (&ps->done, true);
+}
+static void *
+worker_alloc (AI_worker *self, void *ptr, size_t size)
+{
+	void *p = ai_try_alloc (ptr, size);
+	if (NULL == p)
+	{
+		worker_fail (self, AI_ERR_NOMEM);
+	}
+	return p;
+}
+static void
+table_insert (AI_worker *self, AI_node *node)
+{	/*Open addressing, kept under half full*/
+	uint32_t mask = self->ncap - 1;
+	uint32_t i = (uint32_t)conds_hash (node->cond.state)&mask;
+	while (self->table[i])
+	{
+		i = (i + 1)&mask;
+	}
+	self->table[i] = node;
+	self->ntable++;
+}
+static AI_node *
+table_find (AI_worker *self, AI_conds cond)
+{
+	if (!self->ncap)
+	{
+		return NULL;
+	}
+	uint32_t mask = self->ncap - 1;
+	uint32_t i = (uint32_t)conds_hash (cond.state)&mask;
+	while (self->table[i])
+	{
+		AI_node *n = self->table[i];
+		if (ai_conds_compare (&n->cond, &cond, ~0)) return n;
+		i = (i + 1)&mask;
+	}
+	return NULL;
+}
+static bool
+table_grow (AI_worker *self)
+{
+	uint32_t ncap = self->ncap ? self->ncap<<1 : AI_MIN_NODES;
+	AI_node **old = self->table;
+	uint32_t nold = self->ncap;
+	AI_node **table = worker_alloc (self, NULL, ncap*sizeof (table[0]));
+	if (NULL == table)
+	{
+		return false;
+	}
+	self->table = table;
+	memset (self->table, 0, ncap*sizeof (self->table[0]));
+	self->ncap = ncap;
+	self->ntable = 0;
+	for (uint32_t i = 0; i < nold; i++)
+	{
+		if (old[i]) table_insert (self, old[i]);
+	}
+	ai_free (old);
+	return true;
+}
+static AI_node *
+node_alloc (AI_worker *self)
+{
+	AI_parallel *ps = self->search;
+	if (AI_PARALLEL_MAX_NODES <= atomic_fetch_add (&ps->nnodes, 1))
+	{
+		worker_fail (self, AI_ERR_MAXNODES);
+		return NULL;
+	}
+	if (self->used == self->nchunks*AI_PARALLEL_CHUNK)
+	{
+		size_t size = (self->nchunks + 1)*sizeof (self->chunks[0]);
+		AI_node **chunks = worker_alloc (self, self->chunks, size);
+		if (NULL == chunks)
+		{
+			return NULL;
+		}
+		self->chunks = chunks;
+		AI_node *chunk = worker_alloc (self, NULL, AI_PARALLEL_CHUNK*sizeof (AI_node));
+		if (NULL == chunk)
+		{
+			return NULL;
+		}
+		self->chunks[self->nchunks++] = chunk;
+	}
+	uint32_t i = self->used++;
+	self->stats.generated++;
+	return &self->chunks[i/AI_PARALLEL_CHUNK][i%AI_PARALLEL_CHUNK];
+}
+/*Offers a path to a state owned by this worker*/
+static void
+worker_relax (AI_worker *self, AI_message *msg)
+{
+	AI_parallel *ps = self->search;
+	AI_node *node = table_find (self, msg->cond);
+	if (NULL == node)
+	{
+		if (self->ncap <= self->ntable<<1 && !table_grow (self))
+		{
+			return;
+		}
+		node = node_alloc (self);
+		if (NULL == node)
+		{
+			return;
+		}
+		node->cond = msg->cond;
+		node->g = UINT32_MAX;
+		node->slot = AI_INVALID;
+		table_insert (self, node);
+	}
+	if (msg->g < node->g)
+	{
+		if (UINT32_MAX != node->g) self->stats.improved++;
+		node->act = msg->act;
+		node->parent = msg->parent;
+		node->g = msg->g;
+		node->f = msg->g + ai_heuristic (msg->cond, ps->goal);
+		if (ai_queue_contains (&self->opened, node))
+		{
+			ai_queue_update (&self->opened, node);
+		}
+		else if (ai_queue_reserve (&self->opened))
+		{
+			ai_queue_push (&self->opened, node);
+		}
+		else worker_fail (self, AI_ERR_NOMEM);
+	}
+}
+static void
+worker_publish (AI_worker *self)
+{	/*Messages not sent yet may be cheaper than anything queued*/
+	AI_node *n = ai_queue_peek (&self->opened);
+	uint32_t min = n ? n->f : UINT32_MAX;
+	atomic_store (&self->min, self->pending ? 0 : min);
+}
+static uint32_t
+worker_receive (AI_worker *self)
+{
+	AI_parallel *ps = self->search;
+	AI_batch *batch = atomic_exchange (&self->inbox, NULL);
+	uint32_t n = 0;
+	while (batch)
+	{
+		AI_batch *next = batch->next;
+		for (uint32_t i = 0; i < batch->n; i++)
+		{
+			worker_relax (self, &batch->msgs[i]);
+		}
+		ai_free (batch);
+		batch = next;
+		n++;
+	}
+	/*Only count the batches once their nodes are visible in the minimum*/
+	if (n)
+	{
+		worker_publish (self);
+		atomic_fetch_add (&ps->received, n);
+	}
+	return n;
+}
+static void
+worker_flush (AI_worker *self, uint32_t to)
+{
+	AI_parallel *ps = self->search;
+	AI_batch *batch = self->outbox[to];
+	if (NULL == batch)
+	{
+		return;
+	}
+	self->outbox[to] = NULL;
+	self->pending -= batch->n;
+	atomic_fetch_add (&ps->sent, 1);
+	AI_worker *dst = &ps->workers[to];
+	AI_batch *head = atomic_load (&dst->inbox);
+	do
+	{
+		batch->next = head;
+	}
+	while (!atomic_compare_exchange_weak (&dst->inbox, &head, batch));
+}
+static void
+worker_send (AI_worker *self, uint32_t to, AI_message *msg)
+{
+	AI_batch *batch = self->outbox[to];
+	if (NULL == batch)
+	{
+		batch = worker_alloc (self, NULL, sizeof (*batch));
+		if (NULL == batch)
+		{
+			return;
+		}
+		batch->n = 0;
+		self->outbox[to] = batch;
+	}
+	batch->msgs[batch->n++] = *msg;
+	self->pending++;
+	if (AI_PARALLEL_BATCH == batch->n)
+	{
+		worker_flush (self, to);
+	}
+}
+static void
+worker_expand (AI_worker *self, AI_node *n)
+{
+	AI_parallel *ps = self->search;
+	AI_mind *mind = ps->mind;
+	self->stats.considered += ps->nrelevant;
+	self->stats.pruned += mind->nactions - ps->nrelevant;
+	for (uint32_t j = 0; j < ps->nrelevant; j++)
+	{
+		uint32_t i = ps->relevant[j];
+		AI_action *act = mind->actions + i;
+		if (!ai_conds_compare (&act->entry, &n->cond, act->entry.enabled))
+		{
+			continue;
+		}
+		if (!ai_action_possible (act, i, ps->user))
+		{
+			continue;
+		}
+		AI_message msg;
+		msg.parent = n;
+		msg.cond = ai_conds_merge (&n->cond, &act->exit);
+		msg.g = n->g + act->cost;
+		if (act->evaluate)
+		{
+			msg.g = n->g + ai_memo_cost (
+				&self->memo, mind, i, &n->cond, ps->user, &self->stats);
+		}
+		msg.act = i;
+		uint32_t to = conds_owner (ps, msg.cond.state);
+		if (to == self->id) worker_relax (self, &msg);
+		else worker_send (self, to, &msg);
+	}
+}
+/*The search is over once every batch sent has been received, and no worker
+holds a node cheaper than the best goal. Workers publish their minimum before
+acknowledging batches, so a send racing with this check changes the count*/
+static bool
+parallel_finished (AI_parallel *ps)
+{
+	uint64_t sent = atomic_load (&ps->sent);
+	if (atomic_load (&ps->received) != sent)
+	{
+		return false;
+	}
+	uint32_t best = atomic_load (&ps->incumbent);
+	for (uint32_t i = 0; i < ps->nworkers; i++)
+	{
+		if (atomic_load (&ps->workers[i].min) < best) return false;
+	}
+	return atomic_load (&ps->sent) == sent;
+}
+/*Does one round of work, returning false when there was none to do*/
+static bool
+worker_step (AI_worker *self)
+{
+	AI_parallel *ps = self->search;
+	uint32_t received = worker_receive (self);
+	AI_node *n = ai_queue_peek (&self->opened);
+	if (n && n->f < atomic_load (&ps->incumbent))
+	{	/*The heuristic isn't consistent, so children may be cheaper than n.
+		Until they are published the minimum is held at a floor*/
+		atomic_store (&self->min, 0);
+		ai_queue_pop (&self->opened);
+		self->stats.expanded++;
+		if (ai_conds_compare (&n->cond, &ps->goal, ps->goal.enabled))
+		{/*Lower the incumbent unless someone beat us to it*/
+			uint32_t best = atomic_load (&ps->incumbent);
+			while (n->f < best)
+			{
+				if (atomic_compare_exchange_weak (&ps->incumbent, &best, n->f))
+				{
+					self->goal = n;
+					break;
+				}
+			}
+		}
+		else worker_expand (self, n);
+		worker_publish (self);
+		return true;
+	}
+	/*Nothing worth expanding, so send off the batches held back and see if
+	everyone else is done too*/
+	for (uint32_t i = 0; i < ps->nworkers; i++)
+	{
+		worker_flush (self, i);
+	}
+	worker_publish (self);
+	if (received)
+	{
+		return true;
+	}
+	if (parallel_finished (ps))
+	{
+		atomic_store (&ps->done, true);
+	}
+	return false;
+}
+static int
+worker_run (void *arg)
+{
+	AI_worker *self = arg;
+	while (!atomic_load (&self->search->done))
+	{
+		if (!worker_step (self)) thrd_yield ();
+	}
+	return 0;
+}
+static void
+worker_release (AI_worker *self)
+{
+	AI_batch *batch = atomic_exchange (&self->inbox, NULL);
+	while (batch)
+	{
+		AI_batch *next = batch->next;
+		ai_free (batch);
+		batch = next;
+	}
+	for (uint32_t i = 0; i < AI_MAX_WORKERS; i++)
+	{
+		ai_free (self->outbox[i]);
+	}
+	for (uint32_t i = 0; i < self->nchunks; i++)
+	{
+		ai_free (self->chunks[i]);
+	}
+	ai_free (self->chunks);
+	ai_free (self->table);
+	ai_queue_release (&self->opened);
+}
+uint32_t
+ai_mind_solve_parallel (
+	AI_mind *self,
+	AI_plan *plan,
+	AI_conds world,
+	AI_conds goal,
+	void *user,
+	uint32_t nworkers
+){
+	/*Ensure there is actual work to do*/
+	if (ai_conds_compare (&world, &goal, goal.enabled))
+	{
+		ai_plan_assign (plan, self, ai_plan_body_create (world, goal, 0));
+		return 0;
+	}
+#ifdef AI_USE_REACHABILITY
+	if (!ai_reach_possible (self, world, goal))
+	{
+		_stats.solves++;
+		_stats.rejected++;
+		return AI_INVALID;
+	}
+#endif
+	if (nworkers < 1) nworkers = 1;
+	if (AI_MAX_WORKERS < nworkers) nworkers = AI_MAX_WORKERS;
+	AI_parallel *ps = ai_alloc (NULL, sizeof (*ps));
+	memset (ps, 0, sizeof (*ps));
+	ps->mind = self;
+	ps->goal = goal;
+	ps->user = user;
+	ps->nworkers = nworkers;
+	ps->relevant = ai_alloc (NULL, AI_RELEVANT_SIZE (self));
+	ps->nrelevant = ai_mind_relevant (self, world, goal, ps->relevant);
+	atomic_init (&ps->incumbent, UINT32_MAX);
+	atomic_init (&ps->sent, 0);
+	atomic_init (&ps->received, 0);
+	atomic_init (&ps->nnodes, 0);
+	atomic_init (&ps->done, false);
+	atomic_init (&ps->error, 0);
+	for (uint32_t i = 0; i < nworkers; i++)
+	{
+		AI_worker *w = &ps->workers[i];
+		w->search = ps;
+		w->id = i;
+		atomic_init (&w->inbox, NULL);
+		atomic_init (&w->min, UINT32_MAX);
+		ai_queue_init (&w->opened, NULL, 0);
+		ai_memo_clear (&w->memo);
+	}
+	/*Hand the root to its owner before anyone starts*/
+	AI_message root = {NULL, world, 0, AI_INVALID};
+	AI_worker *owner = &ps->workers[conds_owner (ps, world.state)];
+	worker_relax (owner, &root);
+	worker_publish (owner);
+	/*The calling thread works too. Partitions are fixed by the hash, so if
+	a thread can't be had the caller stands in for it as well*/
+	uint32_t started = 1;
+	for (; started < nworkers; started++)
+	{
+		AI_worker *w = &ps->workers[started];
+		if (thrd_success != thrd_create (&w->thread, worker_run, w))
+		{
+			break;
+		}
+	}
+	while (!atomic_load (&ps->done))
+	{
+		bool busy = worker_step (&ps->workers[0]);
+		for (uint32_t i = started; i < nworkers; i++)
+		{
+			busy |= worker_step (&ps->workers[i]);
+		}
+		if (!busy) thrd_yield ();
+	}
+	for (uint32_t i = 1; i < started; i++)
+	{
+		thrd_join (ps->workers[i].thread, NULL);
+	}
+	/*Gather the statistics and the cheapest goal*/
+	AI_node *best = NULL;
+	_stats.solves++;
+	for (uint32_t i = 0; i < nworkers; i++)
+	{
+		AI_worker *w = &ps->workers[i];
+		_stats.expanded += w->stats.expanded;
+		_stats.generated += w->stats.generated;
+		_stats.improved += w->stats.improved;
+		_stats.considered += w->stats.considered;
+		_stats.pruned += w->stats.pruned;
+		_stats.evaluated += w->stats.evaluated;
+		if (w->goal && (NULL == best || w->goal->f < best->f))
+		{
+			best = w->goal;
+		}
+	}
+	uint32_t result = AI_INVALID;
+	uint32_t error = atomic_load (&ps->error);
+	if (best && !error)
+	{
+		ai_plan_assign (plan, self, ai_mind_body_build (goal, best));
+		result = best->f;
+	}
+	for (uint32_t i = 0; i < nworkers; i++)
+	{
+		worker_release (&ps->workers[i]);
+	}
+	ai_free (ps->relevant);
+	ai_free (ps);
+	if (error)
+	{
+		return ai_throw (error);
+	}
+	return result;
+}
+#endif
@@ -1,9 +1,73 @@
 #include "local.h"
 
+AI_plan_body *
+ai_plan_body_create (
+	AI_conds world,
+	AI_conds goal,
+	uint32_t used
+){
+	size_t size = sizeof (AI_plan_body) + used*sizeof (AI_handle);
+	AI_plan_body *body = ai_alloc (NULL, size);
+	atomic_init (&body->refs, 1);
+	body->world = world;
+	body->goal = goal;
+	body->used = used;
+	return body;
+}
+AI_plan_body *
+ai_plan_body_retain (AI_plan_body *body)
+{
+	if (body)
+	{
+		atomic_fetch_add_explicit (&body->refs, 1, memory_order_relaxed);
+	}
+	return body;
+}
+void
+ai_plan_body_release (AI_plan_body *body)
+{
+	if (NULL == body)
+	{
+		return;
+	}
+	if (1 == atomic_fetch_sub_explicit (&body->refs, 1, memory_order_acq_rel))
+	{
+		ai_free (body);
+	}
+}
+/*Forgets the refinement of the macro at the head*/
+static void
+plan_unrefine (AI_plan *self)
+{
+	if (self->sub)
+	{
+		ai_plan_destroy (self->sub);
+		self->sub = NULL;
+	}
+}
+void
+ai_plan_assign (AI_plan *self, AI_mind *mind, AI_plan_body *body)
+{	/*Takes over the reference to body held by the caller*/
+	plan_unrefine (self);
+	ai_plan_body_release (self->body);
+	ai_mind_retain (mind);
+	ai_mind_release (self->mind);
+	self->mind = mind;
+	self->body = body;
+	self->head = body ? body->used : 0;
+	if (body) self->world = body->world;
+	else ai_conds_clear (&self->world);
+}
+uint32_t
+ai_plan_length (AI_plan *self)
+{
+	return self->body ? self->body->used : 0;
+}
 AI_action *
 ai_plan_action (AI_plan *self, uint32_t index)
 {
-	if (self->used <= index)
+	uint32_t used = ai_plan_length (self);
+	if (used <= index)
 	{
 		return NULL;
 	}
@@ -11,18 +75,69 @@ ai_plan_action (AI_plan *self, uint32_t index)
 	{
 		return NULL;
 	}
-	return self->mind->actions + self->acts[self->used - index - 1];
+	return self->mind->actions + self->body->acts[used - index - 1];
+}
+/*Descends through the macros at the head of the plan down to the plan whose
+next step is a primitive action. Macros are refined into sub plans as they 
+are reached, and popped once their sub plans complete. NULL is returned when
+there is nothing to perform, with status saying why*/
+static AI_plan *
+plan_leaf (AI_plan *self, void *user, int *status)
+{
+	while (self->head)
+	{
+		AI_action *act = &self->mind->actions[self->body->acts[self->head - 1]];
+		if (NULL == act->sub)
+		{
+			return self;
+		}
+		if (NULL == self->sub)
+		{
+			AI_plan *sub = ai_plan_create ();
+			AI_conds world = ai_mind_conds_translate (
+				act->sub, self->mind, self->world);
+			if (AI_INVALID == ai_mind_solve (
+				act->sub, sub, world, act->subgoal, user))
+			{
+				ai_plan_destroy (sub);
+				*status = AI_PLAN_INTERRUPTED;
+				return NULL;
+			}
+			self->sub = sub;
+		}
+		AI_plan *leaf = plan_leaf (self->sub, user, status);
+		if (leaf || AI_PLAN_INTERRUPTED == *status)
+		{
+			return leaf;
+		}
+		/*The macro is done, carry on past it*/
+		plan_unrefine (self);
+		self->head--;
+		self->world = ai_conds_merge (&self->world, &act->exit);
+	}
+	*status = AI_PLAN_COMPLETED;
+	return NULL;
+}
+/*Advances a leaf plan past its next action, returning it*/
+static AI_action *
+plan_advance (AI_plan *self)
+{
+	uint32_t index = self->body->acts[--self->head];
+	AI_action *act = &self->mind->actions[index];
+	self->world = ai_conds_merge (&self->world, &act->exit);
+	return act;
 }
 int
 ai_plan_step (AI_plan *self, void *user)
-{	/*Is the plan empty?*/
-	if (!self->head)
+{	/*Is the plan done?*/
+	int status = AI_PLAN_COMPLETED;
+	AI_plan *leaf = plan_leaf (self, user, &status);
+	if (NULL == leaf)
 	{
-		return AI_PLAN_COMPLETED;
+		return status;
 	}
 	/*Perform the action*/
-	uint32_t index = self->acts[--self->head];
-	AI_action *act = &self->mind->actions[index];
+	AI_action *act = plan_advance (leaf);
 	if (act->perform)
 	{
 		return act->perform (act, user);
@@ -30,23 +145,256 @@ ai_plan_step (AI_plan *self, void *user)
 	/*No routine to perform, so what else?*/
 	return AI_PLAN_CONTINUING;
 }
+bool
+ai_plan_validate (AI_plan *self, AI_conds world, void *user)
+{
+	if (NULL == self->body)
+	{
+		return true;
+	}
+	/*Simulate the remaining actions, which must all be enterable and must
+	still arrive at the goal*/
+	AI_conds sim = world;
+	for (uint32_t i = self->head; i > 0; i--)
+	{
+		AI_action *act = &self->mind->actions[self->body->acts[i - 1]];
+		if (!ai_conds_compare (&act->entry, &sim, act->entry.enabled))
+		{
+			return false;
+		}
+		if (act->precondition && !act->precondition (act, user))
+		{
+			return false;
+		}
+		sim = ai_conds_merge (&sim, &act->exit);
+	}
+	return ai_conds_compare (&sim, &self->body->goal, self->body->goal.enabled);
+}
+/*Computes the conditions needed before act so that need holds after it. 
+Fails when act undoes a needed condition or its entry contradicts one*/
+static bool
+conds_regress (AI_conds *need, AI_action *act)
+{
+	AI_condition both = need->enabled&act->exit.enabled;
+	if ((need->state^act->exit.state)&both)
+	{
+		return false;
+	}
+	AI_conds r;
+	r.enabled = need->enabled&~act->exit.enabled;
+	r.state = need->state&r.enabled;
+	both = r.enabled&act->entry.enabled;
+	if ((r.state^act->entry.state)&both)
+	{
+		return false;
+	}
+	need->enabled = r.enabled|act->entry.enabled;
+	need->state = r.state|(act->entry.state&act->entry.enabled);
+	return true;
+}
+uint32_t
+ai_plan_repair (AI_plan *self, AI_conds world, void *user)
+{
+	AI_plan_body *body = self->body;
+	if (NULL == body)
+	{
+		return AI_INVALID;
+	}
+	/*Regress the goal backward through the remaining steps. need[p] holds
+	what the world must look like for the last p steps to reach the goal,
+	and the longest suffix that can still work ends the regression. Searches
+	may throw, so need lives on the stack, and only the last AI_MAX_NODES
+	steps of plans lengthened by earlier repairs are regressed*/
+	uint32_t head = self->head;
+	uint32_t limit = head < AI_MAX_NODES ? head : AI_MAX_NODES;
+	AI_conds need[AI_MAX_NODES + 1];
+	uint32_t valid = 0;
+	need[0] = body->goal;
+	while (valid < limit)
+	{
+		AI_action *act = &self->mind->actions[body->acts[valid]];
+		AI_conds r = need[valid];
+		if (act->precondition && !act->precondition (act, user))
+		{
+			break;
+		}
+		if (!conds_regress (&r, act))
+		{
+			break;
+		}
+		need[++valid] = r;
+	}
+	/*Resume from the shortest suffix the world already satisfies, skipping
+	steps that have become unnecessary*/
+	for (uint32_t p = 0; p <= valid; p++)
+	{
+		if (ai_conds_compare (&world, &need[p], need[p].enabled))
+		{
+			if (p != head) plan_unrefine (self);
+			self->head = p;
+			self->world = world;
+			return 0;
+		}
+	}
+	/*Search for a prefix bridging to the longest valid suffix, and failing
+	that replan from scratch*/
+	uint32_t suffix = valid;
+	AI_node *n = ai_mind_search (self->mind, world, need[suffix], user);
+	if (NULL == n && suffix)
+	{
+		suffix = 0;
+		n = ai_mind_search (self->mind, world, need[suffix], user);
+	}
+	if (NULL == n)
+	{
+		return AI_INVALID;
+	}
+	/*Splice the bridge in front of the suffix. As bodies are stored last
+	action first the suffix is copied as is and the bridge follows it*/
+	uint32_t used = suffix;
+	for (AI_node *node = n; node->parent != NULL; node = node->parent)
+	{
+		used++;
+	}
+	AI_plan_body *repaired = ai_plan_body_create (world, body->goal, used);
+	memcpy (repaired->acts, body->acts, suffix*sizeof (body->acts[0]));
+	uint32_t i = suffix;
+	for (AI_node *node = n; node->parent != NULL; node = node->parent)
+	{
+		repaired->acts[i++] = (AI_handle)node->act;
+	}
+	uint32_t result = n->f;
+	ai_plan_assign (self, self->mind, repaired);
+	return result;
+}
+/*Batched steps are sorted by action so each one is performed in a single 
+sweep over its users*/
+typedef struct _AI_step
+{
+	AI_action *act;
+	uint32_t index;
+}AI_step;
+static int
+step_compare (const void *a, const void *b)
+{
+	const AI_step *x = a;
+	const AI_step *y = b;
+	uintptr_t p = (uintptr_t)x->act;
+	uintptr_t q = (uintptr_t)y->act;
+	if (p != q) return p < q ? -1 : 1;
+	return x->index < y->index ? -1 : (x->index > y->index);
+}
+/*Scratch of ai_plan_step_batch, grown to fit the largest batch stepped*/
+AI_SHARED AI_step *_steps;
+AI_SHARED size_t _nsteps;
+
+void
+ai_plan_scratch_release (void)
+{
+	ai_free (_steps);
+	_steps = NULL;
+	_nsteps = 0;
+}
+void
+ai_plan_step_batch (
+	AI_plan **plans,
+	void **users,
+	uint32_t n,
+	int *results
+){
+	if (!n)
+	{
+		return;
+	}
+	/*Scratch space for the steps, and the gathered users and results of
+	the action being performed*/
+	size_t size = n*(sizeof (AI_step) + sizeof (void *) + sizeof (int));
+	if (_nsteps < size)
+	{
+		_steps = ai_alloc (_steps, size);
+		_nsteps = size;
+	}
+	AI_step *steps = _steps;
+	void **gathered = (void **)(steps + n);
+	int *returned = (int *)(gathered + n);
+	/*Advance every plan, setting aside the ones with nothing to perform*/
+	uint32_t nsteps = 0;
+	for (uint32_t i = 0; i < n; i++)
+	{
+		AI_plan *leaf = plan_leaf (plans[i], users[i], &results[i]);
+		if (NULL == leaf)
+		{
+			continue;
+		}
+		steps[nsteps].act = plan_advance (leaf);
+		steps[nsteps].index = i;
+		nsteps++;
+	}
+	qsort (steps, nsteps, sizeof (steps[0]), step_compare);
+	/*Perform each run of identical actions*/
+	uint32_t first = 0;
+	while (first < nsteps)
+	{
+		AI_action *act = steps[first].act;
+		uint32_t last = first + 1;
+		while (last < nsteps && steps[last].act == act)
+		{
+			last++;
+		}
+		uint32_t count = last - first;
+		if (act->perform_batch)
+		{
+			for (uint32_t i = 0; i < count; i++)
+			{
+				gathered[i] = users[steps[first + i].index];
+			}
+			act->perform_batch (act, gathered, count, returned);
+			for (uint32_t i = 0; i < count; i++)
+			{
+				results[steps[first + i].index] = returned[i];
+			}
+		}
+		else for (uint32_t i = first; i < last; i++)
+		{
+			uint32_t index = steps[i].index;
+			results[index] = AI_PLAN_CONTINUING;
+			if (act->perform)
+			{
+				results[index] = act->perform (act, users[index]);
+			}
+		}
+		first = last;
+	}
+}
+void
+ai_plan_share (AI_plan *self, AI_plan *from)
+{	/*Both plans execute the same body, each from its own start*/
+	if (self == from)
+	{
+		plan_unrefine (self);
+		self->head = ai_plan_length (self);
+		if (self->body) self->world = self->body->world;
+		return;
+	}
+	ai_plan_assign (self, from->mind, ai_plan_body_retain (from->body));
+}
 void
 ai_plan_reset (AI_plan *self)
 {
-	self->nacts = AI_MIN_PLAN;
-	self->acts = ai_alloc (self->acts, AI_MIN_PLAN); 
+	ai_plan_assign (self, NULL, NULL);
 }
 AI_plan *
 ai_plan_create (void)
 {
 	AI_plan *self = ai_alloc (NULL, sizeof (*self));
 	memset (self, 0, sizeof (*self));
-	ai_plan_reset (self);
 	return self;
 }
 void
 ai_plan_destroy (AI_plan *self)
 {
-	ai_free (self->acts);
+	plan_unrefine (self);
+	ai_plan_body_release (self->body);
+	ai_mind_release (self->mind);
 	ai_free (self);
 }
@@ -0,0 +1,271 @@
+#include "local.h"
+
+#if defined (AI_USE_BUCKET_QUEUE)
+/*Buckets hold doubly linked lists of nodes sharing the same cost. Costs
+beyond the last bucket all land in it, and it is scanned like a plain list*/
+static uint32_t
+bucket_index (AI_node *node)
+{
+	if (AI_QUEUE_BUCKETS <= node->f)
+	{
+		return AI_QUEUE_BUCKETS - 1;
+	}
+	return node->f;
+}
+static void
+bucket_link (AI_queue *self, AI_node *node)
+{
+	uint32_t b = bucket_index (node);
+	AI_node *head = self->buckets[b];
+	node->prev = NULL;
+	node->next = head;
+	if (head) head->prev = node;
+	self->buckets[b] = node;
+	node->slot = b;
+	if (b < self->low) self->low = b;
+}
+static void
+bucket_unlink (AI_queue *self, AI_node *node)
+{
+	if (node->prev) node->prev->next = node->next;
+	else self->buckets[node->slot] = node->next;
+	if (node->next) node->next->prev = node->prev;
+	node->slot = AI_INVALID;
+}
+void
+ai_queue_init (AI_queue *self, AI_node **set, uint32_t cap)
+{
+	(void)set;
+	(void)cap;
+	memset (self, 0, sizeof (*self));
+	self->low = AI_QUEUE_BUCKETS;
+}
+void
+ai_queue_release (AI_queue *self)
+{
+	(void)self;
+}
+bool
+ai_queue_reserve (AI_queue *self)
+{
+	(void)self;
+	return true;
+}
+void
+ai_queue_push (AI_queue *self, AI_node *node)
+{
+	bucket_link (self, node);
+	self->len++;
+}
+void
+ai_queue_update (AI_queue *self, AI_node *node)
+{	/*Relink the node if its cost moved it to another bucket*/
+	if (bucket_index (node) == node->slot)
+	{
+		return;
+	}
+	bucket_unlink (self, node);
+	bucket_link (self, node);
+}
+AI_node *
+ai_queue_peek (AI_queue *self)
+{
+	if (!self->len)
+	{
+		return NULL;
+	}
+	while (NULL == self->buckets[self->low])
+	{
+		self->low++;
+	}
+	/*Nodes in a bucket share f, so only scan it when something else decides
+	the order: either the tie breaking or the overflowing last bucket*/
+	AI_node *best = self->buckets[self->low];
+#if !defined (AI_USE_TIE_BREAKING)
+	if (AI_QUEUE_BUCKETS - 1 == self->low)
+#endif
+	{
+		for (AI_node *n = best->next; n != NULL; n = n->next)
+		{
+			if (ai_node_less (n, best)) best = n;
+		}
+	}
+	return best;
+}
+AI_node *
+ai_queue_pop (AI_queue *self)
+{
+	AI_node *best = ai_queue_peek (self);
+	if (best)
+	{
+		bucket_unlink (self, best);
+		self->len--;
+	}
+	return best;
+}
+#elif defined (AI_USE_MIN_HEAP)
+/*Indexed binary heap. Each node remembers its position so its cost can be
+lowered in place and sifted back up*/
+static void
+heap_place (AI_queue *self, uint32_t i, AI_node *node)
+{
+	self->set[i] = node;
+	node->slot = i;
+}
+static void
+heap_up (AI_queue *self, uint32_t i)
+{
+	AI_node *node = self->set[i];
+	while (i)
+	{
+		uint32_t p = (i - 1)>>1;
+		if (!ai_node_less (node, self->set[p]))
+		{
+			break;
+		}
+		heap_place (self, i, self->set[p]);
+		i = p;
+	}
+	heap_place (self, i, node);
+}
+static void
+heap_down (AI_queue *self, uint32_t i)
+{
+	uint32_t len = self->len;
+	AI_node *node = self->set[i];
+	while (1)
+	{
+		uint32_t min = i;
+		AI_node *best = node;
+		uint32_t l = (i<<1) + 1;
+		uint32_t r = (i<<1) + 2;
+		if (l < len && ai_node_less (self->set[l], best)) best = self->set[min = l];
+		if (r < len && ai_node_less (self->set[r], best)) best = self->set[min = r];
+		if (min == i)
+		{
+			break;
+		}
+		heap_place (self, i, best);
+		i = min;
+	}
+	heap_place (self, i, node);
+}
+#endif
+
+#if !defined (AI_USE_BUCKET_QUEUE)
+void
+ai_queue_init (AI_queue *self, AI_node **set, uint32_t cap)
+{
+	self->len = 0;
+	self->owned = (NULL == set);
+	self->set = set;
+	self->cap = self->owned ? 0 : cap;
+}
+void
+ai_queue_release (AI_queue *self)
+{
+	if (self->owned)
+	{
+		ai_free (self->set);
+	}
+	self->set = NULL;
+	self->len = self->cap = 0;
+}
+/*Makes room for one more push without throwing, failing when memory runs out
+or the storage isn't owned*/
+bool
+ai_queue_reserve (AI_queue *self)
+{
+	if (self->len < self->cap)
+	{
+		return true;
+	}
+	if (!self->owned)
+	{
+		return false;
+	}
+	uint32_t cap = self->cap + AI_NODES_GRANULARITY;
+	AI_node **set = ai_try_alloc (self->set, cap*sizeof (set[0]));
+	if (NULL == set)
+	{
+		return false;
+	}
+	self->set = set;
+	self->cap = cap;
+	return true;
+}
+void
+ai_queue_push (AI_queue *self, AI_node *node)
+{	/*Ensure there is space for the addition, growing if we may*/
+	if (self->cap <= self->len)
+	{
+		if (!self->owned)
+		{
+			ai_throw (AI_ERR_MAXNODES);
+		}
+		uint32_t cap = self->cap + AI_NODES_GRANULARITY;
+		self->set = ai_alloc (self->set, cap*sizeof (self->set[0]));
+		self->cap = cap;
+	}
+	uint32_t len = self->len++;
+	self->set[len] = node;
+	node->slot = len;
+#if defined (AI_USE_MIN_HEAP)
+	heap_up (self, len);
+#endif
+}
+void
+ai_queue_update (AI_queue *self, AI_node *node)
+{	/*Costs only ever go down, so the node can only climb*/
+#if defined (AI_USE_MIN_HEAP)
+	heap_up (self, node->slot);
+#else
+	(void)self;
+	(void)node;
+#endif
+}
+AI_node *
+ai_queue_peek (AI_queue *self)
+{
+	if (!self->len)
+	{
+		return NULL;
+	}
+	AI_node *ret = self->set[0];
+#if !defined (AI_USE_MIN_HEAP)
+	for (uint32_t i = 1; i < self->len; i++)
+	{
+		if (ai_node_less (self->set[i], ret)) ret = self->set[i];
+	}
+#endif
+	return ret;
+}
+AI_node *
+ai_queue_pop (AI_queue *self)
+{
+	if (!self->len)
+	{
+		return NULL;
+	}
+#if defined (AI_USE_MIN_HEAP)
+	/*Move last element into the root position and sift down to restore
+	the min heap invariant*/
+	AI_node *ret = self->set[0];
+	uint32_t len = --self->len;
+	if (len)
+	{
+		heap_place (self, 0, self->set[len]);
+		heap_down (self, 0);
+	}
+#else
+	/*Take the lowest cost element and swap the last one into its place*/
+	AI_node *ret = ai_queue_peek (self);
+	uint32_t len = --self->len;
+	AI_node *last = self->set[len];
+	self->set[ret->slot] = last;
+	last->slot = ret->slot;
+#endif
+	ret->slot = AI_INVALID;
+	return ret;
+}
+#endif
@@ -0,0 +1,104 @@
+#include "local.h"
+
+#ifdef AI_USE_REACHABILITY
+/*Literals are split by polarity, bit i of pos standing for condition i being
+set and bit i of neg for it being clear*/
+static AI_lits
+lits_of (AI_conds *conds)
+{
+	AI_lits l;
+	l.pos = conds->state&conds->enabled;
+	l.neg = ~conds->state&conds->enabled;
+	return l;
+}
+static void
+lits_remove (AI_lits *dst, AI_lits src)
+{
+	dst->pos &= ~src.pos;
+	dst->neg &= ~src.neg;
+}
+void
+ai_reach_reset (AI_mind *mind)
+{
+	if (NULL == mind->reach)
+	{
+		mind->reach = ai_alloc (NULL, sizeof (AI_reach));
+	}
+	/*With no actions nothing ever changes, so every pair of literals not
+	already holding together never will*/
+	AI_reach *self = mind->reach;
+	self->made.pos = self->made.neg = 0;
+	for (uint32_t i = 0; i < AI_MAX_CONDITIONS; i++)
+	{
+		AI_condition b = (AI_condition)1<<i;
+		self->mutex[0][i].pos = ~b;
+		self->mutex[0][i].neg = ~(AI_condition)0;
+		self->mutex[1][i].pos = ~(AI_condition)0;
+		self->mutex[1][i].neg = ~b;
+	}
+	for (uint32_t i = 0; i < mind->nactions; i++)
+	{
+		ai_reach_add (mind, mind->actions + i);
+	}
+}
+void
+ai_reach_add (AI_mind *mind, AI_action *act)
+{
+	AI_reach *self = mind->reach;
+	AI_lits entry = lits_of (&act->entry);
+	AI_lits exit = lits_of (&act->exit);
+	self->made.pos |= exit.pos;
+	self->made.neg |= exit.neg;
+	/*Literals that may hold after the action without it making them hold:
+	those of conditions it leaves alone, less the ones its entry rules out*/
+	AI_condition left = ~act->exit.enabled;
+	AI_lits kept = {left&~entry.neg, left&~entry.pos};
+	AI_lits both = exit;
+	both.pos |= kept.pos;
+	both.neg |= kept.neg;
+	/*Pairs the action may make hold together are no longer mutex*/
+	for (uint32_t i = 0; i < AI_MAX_CONDITIONS; i++)
+	{
+		AI_condition b = (AI_condition)1<<i;
+		if (exit.pos&b) lits_remove (&self->mutex[0][i], both);
+		if (exit.neg&b) lits_remove (&self->mutex[1][i], both);
+		if (kept.pos&b) lits_remove (&self->mutex[0][i], exit);
+		if (kept.neg&b) lits_remove (&self->mutex[1][i], exit);
+	}
+}
+/*Checks whether conds may ever hold starting out from world. Every literal
+the world lacks must be made by some action, and no two literals may form a
+mutex pair the world doesn't already break. Each pair is preserved by every
+action on its own, so holding in the world is all it takes to hold forever*/
+bool
+ai_reach_possible (AI_mind *mind, AI_conds world, AI_conds conds)
+{
+	AI_reach *self = mind->reach;
+	AI_lits want = lits_of (&conds);
+	AI_lits have = {world.state, ~world.state};
+	if ((want.pos&~have.pos&~self->made.pos) || (want.neg&~have.neg&~self->made.neg))
+	{
+		return false;
+	}
+	AI_condition m = want.pos|want.neg;
+	for (uint32_t i = 0; m; i++, m >>= 1)
+	{
+		AI_condition b = (AI_condition)1<<i;
+		if (!(m&1))
+		{
+			continue;
+		}
+		AI_lits *mutex = self->mutex[(want.pos&b) ? 0 : 1] + i;
+		AI_lits bad = {mutex->pos&want.pos, mutex->neg&want.neg};
+		if ((want.pos&b) ? (have.pos&b) : (have.neg&b))
+		{	/*Pairs the world holds already are fine*/
+			lits_remove (&bad, have);
+		}
+		if (bad.pos|bad.neg)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+#endif
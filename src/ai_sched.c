@@ -0,0 +1,294 @@
+#include <time.h>
+#include "local.h"
+
+static uint64_t
+sched_clock (void)
+{
+	struct timespec ts;
+	timespec_get (&ts, TIME_UTC);
+	return (uint64_t)ts.tv_sec*1000000u + (uint64_t)ts.tv_nsec/1000u;
+}
+/*Requests are kept in a min heap ordered by their virtual deadline, and an
+index from plans to their place in the heap finds the request to coalesce
+with. The index is open addressed with linear probing*/
+static uint32_t
+index_slot (AI_sched *self, AI_plan *plan)
+{
+	uint64_t h = (uint64_t)(uintptr_t)plan*0x9e3779b97f4a7c15ull;
+	return (uint32_t)(h>>32)&(self->nindex - 1);
+}
+static AI_sched_slot *
+index_find (AI_sched *self, AI_plan *plan)
+{
+	uint32_t mask = self->nindex - 1;
+	uint32_t i = index_slot (self, plan);
+	while (self->index[i].plan)
+	{
+		if (self->index[i].plan == plan)
+		{
+			return &self->index[i];
+		}
+		i = (i + 1)&mask;
+	}
+	return NULL;
+}
+static void
+index_insert (AI_sched *self, AI_plan *plan, uint32_t at)
+{
+	uint32_t mask = self->nindex - 1;
+	uint32_t i = index_slot (self, plan);
+	while (self->index[i].plan)
+	{
+		i = (i + 1)&mask;
+	}
+	self->index[i].plan = plan;
+	self->index[i].at = at;
+}
+static void
+index_remove (AI_sched *self, AI_sched_slot *slot)
+{	/*Shift later entries of the probe run back so none become unreachable*/
+	uint32_t mask = self->nindex - 1;
+	uint32_t i = (uint32_t)(slot - self->index);
+	uint32_t j = i;
+	self->index[i].plan = NULL;
+	while (1)
+	{
+		j = (j + 1)&mask;
+		if (NULL == self->index[j].plan)
+		{
+			break;
+		}
+		uint32_t k = index_slot (self, self->index[j].plan);
+		/*Leave j be when its home lies cyclically in (i, j]*/
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+		{
+			continue;
+		}
+		self->index[i] = self->index[j];
+		self->index[j].plan = NULL;
+		i = j;
+	}
+}
+static void
+heap_place (AI_sched *self, uint32_t i, AI_request *req)
+{
+	self->requests[i] = *req;
+	index_find (self, req->plan)->at = i;
+}
+static void
+heap_up (AI_sched *self, uint32_t i)
+{
+	AI_request req = self->requests[i];
+	while (i)
+	{
+		uint32_t p = (i - 1)>>1;
+		if (self->requests[p].order <= req.order)
+		{
+			break;
+		}
+		heap_place (self, i, &self->requests[p]);
+		i = p;
+	}
+	heap_place (self, i, &req);
+}
+static void
+heap_down (AI_sched *self, uint32_t i)
+{
+	AI_request req = self->requests[i];
+	uint32_t len = self->nrequests;
+	while (1)
+	{
+		uint32_t min = i;
+		uint64_t best = req.order;
+		uint32_t l = (i<<1) + 1;
+		uint32_t r = (i<<1) + 2;
+		if (l < len && self->requests[l].order < best) best = self->requests[min = l].order;
+		if (r < len && self->requests[r].order < best) min = r;
+		if (min == i)
+		{
+			break;
+		}
+		heap_place (self, i, &self->requests[min]);
+		i = min;
+	}
+	heap_place (self, i, &req);
+}
+static void
+heap_remove (AI_sched *self, uint32_t i)
+{
+	AI_request *req = &self->requests[i];
+	index_remove (self, index_find (self, req->plan));
+	uint32_t len = --self->nrequests;
+	if (i == len)
+	{
+		return;
+	}
+	/*Move the last request into the hole, its index entry follows along*/
+	index_find (self, self->requests[len].plan)->at = i;
+	self->requests[i] = self->requests[len];
+	heap_up (self, i);
+	heap_down (self, i);
+}
+static void
+sched_grow (AI_sched *self)
+{
+	uint32_t cap = self->cap + AI_SCHED_GRANULARITY;
+	self->requests = ai_alloc (self->requests, cap*sizeof (AI_request));
+	self->cap = cap;
+	/*Keep the index under half full, rebuilding it as it grows*/
+	if (self->nindex < cap<<1)
+	{
+		uint32_t nindex = self->nindex ? self->nindex : AI_SCHED_GRANULARITY;
+		while (nindex < cap<<1) nindex <<= 1;
+		self->index = ai_alloc (self->index, nindex*sizeof (AI_sched_slot));
+		self->nindex = nindex;
+		memset (self->index, 0, nindex*sizeof (AI_sched_slot));
+		for (uint32_t i = 0; i < self->nrequests; i++)
+		{
+			index_insert (self, self->requests[i].plan, i);
+		}
+	}
+}
+AI_sched *
+ai_sched_create (uint32_t budget, AI_solved solved)
+{
+	AI_sched *self = ai_alloc (NULL, sizeof (*self));
+	memset (self, 0, sizeof (*self));
+	self->budget = budget;
+	self->solved = solved;
+	return self;
+}
+void
+ai_sched_destroy (AI_sched *self)
+{
+	for (uint32_t i = 0; i < self->nrequests; i++)
+	{
+		ai_mind_release (self->requests[i].mind);
+	}
+	ai_mind_release (self->solving);
+	ai_free (self->requests);
+	ai_free (self->index);
+	ai_free (self);
+}
+void
+ai_sched_submit (
+	AI_sched *self,
+	AI_plan *plan,
+	AI_mind *mind,
+	AI_conds world,
+	AI_conds goal,
+	void *user,
+	uint32_t priority,
+	uint32_t deadline
+){
+	uint64_t now = sched_clock ();
+	/*Priority pulls the virtual deadline in by a bounded amount, so newer
+	requests can never keep an older one waiting forever*/
+	if (AI_SCHED_PRIORITIES < priority) priority = AI_SCHED_PRIORITIES;
+	uint64_t bonus = (uint64_t)priority*AI_SCHED_QUANTUM;
+	uint64_t due = now + deadline;
+	uint64_t order = due;
+	order = (bonus < order) ? order - bonus : 0;
+	self->stats.submitted++;
+	/*Coalesce with a request still queued for this plan. The latest world
+	wins, while the earliest deadline and submission are kept*/
+	AI_sched_slot *slot = self->nrequests ? index_find (self, plan) : NULL;
+	if (slot)
+	{
+		AI_request *req = &self->requests[slot->at];
+		ai_mind_retain (mind);
+		ai_mind_release (req->mind);
+		req->mind = mind;
+		req->world = world;
+		req->goal = goal;
+		req->user = user;
+		if (due < req->deadline) req->deadline = due;
+		if (order < req->order)
+		{
+			req->order = order;
+			heap_up (self, slot->at);
+		}
+		self->stats.coalesced++;
+		return;
+	}
+	if (self->cap <= self->nrequests)
+	{
+		sched_grow (self);
+	}
+	uint32_t i = self->nrequests++;
+	AI_request *req = &self->requests[i];
+	req->plan = plan;
+	req->mind = ai_mind_retain (mind);
+	req->world = world;
+	req->goal = goal;
+	req->user = user;
+	req->submitted = now;
+	req->deadline = due;
+	req->order = order;
+	index_insert (self, plan, i);
+	heap_up (self, i);
+	self->stats.depth = self->nrequests;
+	if (self->stats.peak < self->nrequests)
+	{
+		self->stats.peak = self->nrequests;
+	}
+}
+void
+ai_sched_cancel (AI_sched *self, AI_plan *plan)
+{
+	AI_sched_slot *slot = self->nrequests ? index_find (self, plan) : NULL;
+	if (slot)
+	{
+		ai_mind_release (self->requests[slot->at].mind);
+		heap_remove (self, slot->at);
+		self->stats.depth = self->nrequests;
+	}
+}
+uint32_t
+ai_sched_tick (AI_sched *self)
+{	/*Solves are bounded by AI_MAX_NODES, so rather than suspending them
+	each tick runs whole solves for as long as the next one is expected to
+	fit. The first one always runs so the queue can never stall*/
+	uint64_t start = sched_clock ();
+	uint32_t n = 0;
+	/*Left over when the last tick was thrown out of*/
+	ai_mind_release (self->solving);
+	self->solving = NULL;
+	while (self->nrequests)
+	{
+		uint64_t now = sched_clock ();
+		if (n && start + self->budget < now + self->estimate)
+		{
+			break;
+		}
+		AI_request req = self->requests[0];
+		heap_remove (self, 0);
+		self->solving = req.mind;
+		uint32_t result = ai_mind_solve (
+			req.mind, req.plan, req.world, req.goal, req.user);
+		self->solving = NULL;
+		ai_mind_release (req.mind);
+		/*Track the cost of a solve with a running average*/
+		uint64_t done = sched_clock ();
+		uint32_t took = (uint32_t)(done - now);
+		self->estimate = (self->estimate*7 + took + 7)/8;
+		/*Bucket the latency by its power of two*/
+		uint64_t latency = done - req.submitted;
+		uint32_t bucket = 0;
+		while (latency && bucket < AI_SCHED_HISTOGRAM - 1)
+		{
+			latency >>= 1;
+			bucket++;
+		}
+		self->stats.latency[bucket]++;
+		if (req.deadline < done) self->stats.missed++;
+		self->stats.solved++;
+		n++;
+		if (self->solved)
+		{
+			self->solved (req.plan, result, req.user);
+		}
+	}
+	self->stats.depth = self->nrequests;
+	return n;
+}
@@ -0,0 +1,200 @@
+#include <time.h>
+#include "local.h"
+
+/*FNV-1a over the parts of a mind that decide how it solves*/
+static uint32_t
+hash_bytes (uint32_t h, const void *data, size_t size)
+{
+	const uint8_t *p = data;
+	for (size_t i = 0; i < size; i++)
+	{
+		h = (h^p[i])*16777619u;
+	}
+	return h;
+}
+static void
+action_describe (AI_action *act, AI_trace_action *out)
+{
+	memset (out, 0, sizeof (*out));
+	out->cost = act->cost;
+	if (act->precondition) out->flags |= AI_TRACE_PRECONDITION;
+	if (act->evaluate) out->flags |= AI_TRACE_EVALUATE;
+	out->entry[0] = act->entry.state;
+	out->entry[1] = act->entry.enabled;
+	out->exit[0] = act->exit.state;
+	out->exit[1] = act->exit.enabled;
+	out->evaluated = act->evaluated;
+}
+uint32_t
+ai_mind_fingerprint (AI_mind *self)
+{
+	uint32_t h = 2166136261u;
+	for (uint32_t i = 0; i < self->nconds; i++)
+	{
+		h = hash_bytes (h, self->conds[i], strlen (self->conds[i]) + 1);
+	}
+	for (uint32_t i = 0; i < self->nactions; i++)
+	{
+		AI_trace_action desc;
+		action_describe (self->actions + i, &desc);
+		h = hash_bytes (h, &desc, sizeof (desc));
+	}
+	return h;
+}
+#ifdef AI_USE_TRACE
+AI_SHARED AI_tracer _trace;
+
+static uint64_t
+trace_clock (void)
+{
+	struct timespec ts;
+	timespec_get (&ts, TIME_UTC);
+	return (uint64_t)ts.tv_sec*1000000000u + (uint64_t)ts.tv_nsec;
+}
+static size_t
+pad8 (size_t size)
+{
+	return (size + 7)&~(size_t)7;
+}
+/*Writes out the mind unless it was written lately*/
+static void
+trace_mind (AI_mind *mind, uint32_t fingerprint)
+{
+	uint32_t n = _trace.nseen < AI_TRACE_MINDS ? _trace.nseen : AI_TRACE_MINDS;
+	for (uint32_t i = 0; i < n; i++)
+	{
+		if (_trace.seen[i] == fingerprint)
+		{
+			return;
+		}
+	}
+	_trace.seen[_trace.nseen++%AI_TRACE_MINDS] = fingerprint;
+	size_t size = sizeof (AI_trace_mind);
+	for (uint32_t i = 0; i < mind->nconds; i++)
+	{
+		size += pad8 (sizeof (uint32_t) + strlen (mind->conds[i]) + 1);
+	}
+	size += mind->nactions*sizeof (AI_trace_action);
+	uint8_t *buf = ai_alloc (NULL, size);
+	memset (buf, 0, size);
+	AI_trace_mind *rec = (AI_trace_mind *)buf;
+	rec->tag = AI_TRACE_MIND;
+	rec->size = (uint32_t)size;
+	rec->fingerprint = fingerprint;
+	rec->nconds = mind->nconds;
+	rec->nactions = mind->nactions;
+	uint8_t *p = buf + sizeof (*rec);
+	for (uint32_t i = 0; i < mind->nconds; i++)
+	{
+		uint32_t len = (uint32_t)strlen (mind->conds[i]);
+		memcpy (p, &len, sizeof (len));
+		memcpy (p + sizeof (len), mind->conds[i], len);
+		p += pad8 (sizeof (len) + len + 1);
+	}
+	for (uint32_t i = 0; i < mind->nactions; i++)
+	{
+		action_describe (mind->actions + i, (AI_trace_action *)p);
+		p += sizeof (AI_trace_action);
+	}
+	_trace.sink (buf, size, _trace.data);
+	ai_free (buf);
+}
+void
+ai_trace_capture (AI_trace_sink sink, void *data)
+{	/*Capture stops when given no sink, which must be done before the thread
+	exits to release what it holds*/
+	if (NULL == sink)
+	{
+		ai_free (_trace.passed);
+		ai_free (_trace.costs);
+		memset (&_trace, 0, sizeof (_trace));
+		return;
+	}
+	_trace.sink = sink;
+	_trace.data = data;
+	_trace.nseen = 0;
+	_trace.serial = 0;
+}
+void
+ai_trace_begin (AI_mind *mind, AI_conds world, AI_conds goal)
+{
+	if (_trace.serial != mind->serial)
+	{
+		_trace.serial = mind->serial;
+		_trace.fingerprint = ai_mind_fingerprint (mind);
+	}
+	trace_mind (mind, _trace.fingerprint);
+	/*A bit for the precondition of every action*/
+	uint32_t nwords = mind->nactions/64 + 1;
+	if (_trace.nwords < nwords)
+	{
+		_trace.passed = ai_alloc (_trace.passed, nwords*sizeof (uint64_t));
+		_trace.nwords = nwords;
+	}
+	memset (_trace.passed, 0, _trace.nwords*sizeof (uint64_t));
+	_trace.ncosts = 0;
+	AI_trace_solve *head = &_trace.head;
+	memset (head, 0, sizeof (*head));
+	head->tag = AI_TRACE_SOLVE;
+	head->fingerprint = _trace.fingerprint;
+	head->world[0] = world.state;
+	head->world[1] = world.enabled;
+	head->goal[0] = goal.state;
+	head->goal[1] = goal.enabled;
+	head->nactions = mind->nactions;
+	_trace.open = true;
+	_trace.start = trace_clock ();
+}
+void
+ai_trace_cost (uint32_t index, AI_condition key, uint32_t cost)
+{
+	if (_trace.cap <= _trace.ncosts)
+	{
+		uint32_t cap = _trace.cap + AI_NODES_GRANULARITY;
+		_trace.costs = ai_alloc (_trace.costs, cap*sizeof (AI_trace_cost));
+		_trace.cap = cap;
+	}
+	AI_trace_cost *c = &_trace.costs[_trace.ncosts++];
+	c->act = index;
+	c->cost = cost;
+	c->key = key;
+}
+void
+ai_trace_end (AI_mind *mind, AI_plan *plan, uint32_t result)
+{
+	AI_trace_solve *head = &_trace.head;
+	head->nanoseconds = trace_clock () - _trace.start;
+	_trace.open = false;
+	head->result = result;
+	head->length = (AI_INVALID == result) ? 0 : ai_plan_length (plan);
+	head->nevaluated = _trace.ncosts;
+	/*Lay the record out behind its head*/
+	size_t acts = pad8 (head->length*sizeof (uint32_t));
+	size_t words = (mind->nactions + 63)/64*sizeof (uint64_t);
+	size_t costs = _trace.ncosts*sizeof (AI_trace_cost);
+	size_t size = sizeof (*head) + acts + words + costs;
+	head->size = (uint32_t)size;
+	uint8_t *buf = ai_alloc (NULL, size);
+	memset (buf, 0, size);
+	memcpy (buf, head, sizeof (*head));
+	uint32_t *indices = (uint32_t *)(buf + sizeof (*head));
+	for (uint32_t i = 0; i < head->length; i++)
+	{
+		indices[i] = (uint32_t)(ai_plan_action (plan, i) - plan->mind->actions);
+	}
+	memcpy (buf + sizeof (*head) + acts, _trace.passed, words);
+	if (costs)
+	{
+		memcpy (buf + sizeof (*head) + acts + words, _trace.costs, costs);
+	}
+	_trace.sink (buf, size, _trace.data);
+	ai_free (buf);
+}
+#else
+void
+ai_trace_capture (AI_trace_sink sink, void *data)
+{
+	(void)sink;
+	(void)data;
+}
+#endif
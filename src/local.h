@@ -1,4 +1,6 @@
 #pragma once
+#include <stddef.h>
+#include <stdatomic.h>
 #include <stdnoreturn.h>
 #include <assert.h>
 #include "ai.h"
@@ -19,9 +21,200 @@ typedef struct _AI_node
 	AI_conds cond;
 	uint32_t g, f;
 	uint32_t act;
+	uint32_t slot; /*Position in the open list, AI_INVALID when closed*/
+#ifdef AI_USE_BUCKET_QUEUE
+	struct _AI_node *prev, *next; /*Links within a bucket*/
+#endif
 }AI_node;
 
+/*Open list of the search. Which implementation is used is selected in conf.h,
+all of them support lowering the cost of a queued node in place*/
+typedef struct _AI_queue
+{
+	uint32_t len;
+#ifdef AI_USE_BUCKET_QUEUE
+	uint32_t low; /*Lowest bucket that may be occupied*/
+	AI_node *buckets[AI_QUEUE_BUCKETS];
+#else
+	uint32_t cap;
+	bool owned; /*Set storage grows on demand when owned*/
+	AI_node **set;
+#endif
+}AI_queue;
+
+void ai_queue_init (AI_queue *self, AI_node **set, uint32_t cap);
+void ai_queue_release (AI_queue *self);
+bool ai_queue_reserve (AI_queue *self);
+void ai_queue_push (AI_queue *self, AI_node *node);
+void ai_queue_update (AI_queue *self, AI_node *node);
+AI_node *ai_queue_peek (AI_queue *self);
+AI_node *ai_queue_pop (AI_queue *self);
+
+static inline bool
+ai_queue_empty (AI_queue *self)
+{
+	return 0 == self->len;
+}
+static inline bool
+ai_queue_contains (AI_queue *self, AI_node *node)
+{
+	return AI_INVALID != node->slot;
+}
+/*Ordering of nodes in the open list. Ties on f are broken in favour of the 
+deeper node, which is the one closer to the goal*/
+static inline bool
+ai_node_less (AI_node *a, AI_node *b)
+{
+	if (a->f != b->f) return a->f < b->f;
+#ifdef AI_USE_TIE_BREAKING
+	return a->g > b->g;
+#else
+	return false;
+#endif
+}
+
+/*Returns the number of unset bits between start and goal. This is analogous
+to computing the linear distance between two points*/
+static inline uint32_t
+ai_heuristic (AI_conds start, AI_conds goal)
+{
+	AI_condition x = (start.state&goal.enabled);
+	AI_condition y = (goal.state&goal.enabled);
+	AI_condition delta = x^y;
+	uint32_t n = AI_MAX_CONDITIONS;
+	while (delta)
+	{
+		delta >>= 1;
+		n--;
+	}
+	return n;
+}
+
+/*Reachability analysis of a mind, kept up to date as actions are added. made
+holds the literals some action makes hold, and mutex[0][i] and mutex[1][i]
+the literals that no action ever makes hold alongside condition i being set
+or clear. Literal i is bit i of pos when set and of neg when clear*/
+typedef struct _AI_lits
+{
+	AI_condition pos, neg;
+}AI_lits;
+typedef struct _AI_reach
+{
+	AI_lits made;
+	AI_lits mutex[2][AI_MAX_CONDITIONS];
+}AI_reach;
+
+void ai_reach_reset (AI_mind *mind);
+void ai_reach_add (AI_mind *mind, AI_action *act);
+bool ai_reach_possible (AI_mind *mind, AI_conds world, AI_conds conds);
+
+/*Plan bodies, shared between plans. Bodies only hold indices of actions, the
+plans holding a body keep the mind those index alive*/
+typedef struct _AI_plan_body
+{
+	_Atomic uint32_t refs;
+	AI_conds world; /*Conditions the plan was solved from*/
+	AI_conds goal; /*Conditions the plan was solved for*/
+	uint32_t used;
+	AI_handle acts[]; /*Stored last action first*/
+}AI_plan_body;
+
+AI_plan_body *ai_plan_body_create (
+	AI_conds world,
+	AI_conds goal,
+	uint32_t used);
+AI_plan_body *ai_plan_body_retain (AI_plan_body *body);
+void ai_plan_body_release (AI_plan_body *body);
+void ai_plan_assign (AI_plan *self, AI_mind *mind, AI_plan_body *body);
+void ai_plan_scratch_release (void);
+
+/*Search*/
+#define AI_RELEVANT_SIZE(mind) \
+	((mind)->nactions*(sizeof (uint32_t) + sizeof (bool)) + 1)
+uint32_t ai_mind_relevant (
+	AI_mind *self,
+	AI_conds world,
+	AI_conds goal,
+	uint32_t *list);
+AI_node *ai_mind_search (
+	AI_mind *self,
+	AI_conds world,
+	AI_conds goal,
+	void *user);
+AI_plan_body *ai_mind_body_build (AI_conds goal, AI_node *node);
+void ai_mind_release (AI_mind *self);
+
+/*Costs of actions with an evaluate callback, memoised for the duration of a
+single search. Entries from earlier searches are told apart by their stamp*/
+typedef struct _AI_memo_entry
+{
+	uint32_t stamp;
+	uint32_t act;
+	AI_condition key;
+	uint32_t cost;
+}AI_memo_entry;
+typedef struct _AI_memo
+{
+	uint32_t stamp;
+	AI_memo_entry entries[AI_COST_MEMO];
+}AI_memo;
+
+void ai_memo_clear (AI_memo *self);
+uint32_t ai_memo_cost (
+	AI_memo *self,
+	AI_mind *mind,
+	uint32_t index,
+	AI_conds *cond,
+	void *user,
+	AI_stats *stats);
+
+/*Capture state of a thread. The outcomes and costs of the solve being traced
+gather here until it completes*/
+typedef struct _AI_tracer
+{
+	AI_trace_sink sink;
+	void *data;
+	bool open; /*Set while a solve is being recorded*/
+	uint32_t serial, fingerprint; /*Of the mind last solved*/
+	uint32_t seen[AI_TRACE_MINDS]; /*Minds already written out*/
+	uint32_t nseen;
+	uint64_t start;
+	AI_trace_solve head;
+	uint32_t nwords;
+	uint64_t *passed;
+	uint32_t ncosts, cap;
+	AI_trace_cost *costs;
+}AI_tracer;
+extern AI_SHARED AI_tracer _trace;
+
+void ai_trace_begin (AI_mind *mind, AI_conds world, AI_conds goal);
+void ai_trace_end (AI_mind *mind, AI_plan *plan, uint32_t result);
+void ai_trace_cost (uint32_t index, AI_condition key, uint32_t cost);
+
+/*Checks the precondition of an action, noting its outcome when tracing*/
+static inline bool
+ai_action_possible (AI_action *act, uint32_t index, void *user)
+{
+	if (NULL == act->precondition)
+	{
+		return true;
+	}
+	bool passed = act->precondition (act, user);
+#ifdef AI_USE_TRACE
+	if (passed && _trace.open)
+	{
+		_trace.passed[index>>6] |= (uint64_t)1<<(index&63);
+	}
+#else
+	(void)index;
+#endif
+	return passed;
+}
+
 /*Shared routines*/
+extern AI_SHARED AI_stats _stats;
+
 AI_NORETURN int ai_throw (uint32_t error);
 void *ai_alloc (void *ptr, size_t size);
+void *ai_try_alloc (void *ptr, size_t size);
 void ai_free (void *ptr);
@@ -52,6 +52,12 @@ print_plan (AI_plan *plan)
 		printf ("}\n");			
 	}
 }
+/*Writes trace records out for the replay tool*/
+static void
+trace_write (const void *data, size_t size, void *file)
+{
+	fwrite (data, 1, size, file);
+}
 /*Helper to add actions to minds*/
 static void
 action_add (AI_mind *mind, AI_action_recipe *recipe)
@@ -92,6 +98,154 @@ action_add (AI_mind *mind, AI_action_recipe *recipe)
 	ai_mind_action_add (mind, &action);
 }
 
+/*Self check, run with --check. Solves random minds, half of whose actions
+price themselves through evaluate, and compares each plan with the cheapest
+found by an exhaustive search over every state*/
+#define CHECK_CONDS 6
+#define CHECK_STATES (1<<CHECK_CONDS)
+#define CHECK_ACTIONS 10
+#define CHECK_MINDS 400
+#define CHECK_SOLVES 40
+
+static uint32_t check_seed = 2463534242u;
+static uint32_t
+check_random (uint32_t n)
+{
+	check_seed ^= check_seed<<13;
+	check_seed ^= check_seed>>17;
+	check_seed ^= check_seed<<5;
+	return check_seed%n;
+}
+/*Writes between 1 and max random literals to conds*/
+static void
+check_literals (AI_conds *conds, uint32_t max)
+{
+	ai_conds_clear (conds);
+	for (uint32_t n = 1 + check_random (max); n; n--)
+	{
+		AI_condition b = (AI_condition)1<<check_random (CHECK_CONDS);
+		ai_conds_write (conds, b, check_random (2));
+	}
+}
+/*Costs a little more for each evaluated condition set*/
+static uint32_t
+check_evaluate (AI_action *act, AI_conds *conds, void *user)
+{
+	AI_condition x = conds->state&act->evaluated;
+	uint32_t cost = act->cost;
+	for (; x; x >>= 1) cost += 3*(x&1);
+	return cost;
+}
+static uint32_t
+check_cost (AI_action *act, AI_conds *conds)
+{
+	return act->evaluate ? act->evaluate (act, conds, NULL) : act->cost;
+}
+/*Dijkstra over every state, returns the cheapest cost of reaching goal*/
+static uint32_t
+check_best (AI_mind *mind, AI_conds world, AI_conds goal)
+{
+	uint32_t dist[CHECK_STATES];
+	bool done[CHECK_STATES] = {false};
+	for (uint32_t i = 0; i < CHECK_STATES; i++) dist[i] = AI_INVALID;
+	dist[world.state] = 0;
+	for (;;)
+	{
+		uint32_t best = AI_INVALID;
+		for (uint32_t i = 0; i < CHECK_STATES; i++)
+		{
+			if (done[i] || AI_INVALID == dist[i]) continue;
+			if (AI_INVALID == best || dist[i] < dist[best]) best = i;
+		}
+		if (AI_INVALID == best) return AI_INVALID;
+		done[best] = true;
+		AI_conds at = {best, world.enabled};
+		if (ai_conds_compare (&at, &goal, goal.enabled)) return dist[best];
+		for (uint32_t i = 0; i < mind->nactions; i++)
+		{
+			AI_action *act = &mind->actions[i];
+			if (!ai_conds_compare (&at, &act->entry, act->entry.enabled)) continue;
+			uint32_t next = ai_conds_merge (&at, &act->exit).state;
+			uint32_t cost = dist[best] + check_cost (act, &at);
+			if (cost < dist[next]) dist[next] = cost;
+		}
+	}
+}
+/*Walks the plan from world, returns its cost or AI_INVALID when it fails*/
+static uint32_t
+check_plan (AI_plan *plan, AI_conds world, AI_conds goal)
+{
+	uint32_t cost = 0;
+	for (uint32_t i = 0; i < ai_plan_length (plan); i++)
+	{
+		AI_action *act = ai_plan_action (plan, i);
+		if (!ai_conds_compare (&world, &act->entry, act->entry.enabled))
+		{
+			return AI_INVALID;
+		}
+		cost += check_cost (act, &world);
+		world = ai_conds_merge (&world, &act->exit);
+	}
+	if (!ai_conds_compare (&world, &goal, goal.enabled)) return AI_INVALID;
+	return cost;
+}
+static int
+check (void)
+{
+	static const char *atoms[CHECK_CONDS] = {"a", "b", "c", "d", "e", "f"};
+	uint32_t solves = 0, failed = 0;
+	AI_plan *plan = ai_plan_create ();
+	for (uint32_t m = 0; m < CHECK_MINDS; m++)
+	{
+		AI_mind *mind = ai_mind_create ();
+		for (uint32_t i = 0; i < CHECK_CONDS; i++)
+		{
+			ai_mind_condition_add (mind, atoms[i]);
+		}
+		for (uint32_t i = 0; i < CHECK_ACTIONS; i++)
+		{
+			AI_action action;
+			memset (&action, 0, sizeof (action));
+			action.name = "random";
+			action.cost = check_random (5);
+			check_literals (&action.entry, 2);
+			check_literals (&action.exit, 2);
+			if (check_random (2))
+			{
+				AI_conds evaluated;
+				check_literals (&evaluated, 2);
+				action.evaluate = check_evaluate;
+				action.evaluated = evaluated.enabled;
+			}
+			ai_mind_action_add (mind, &action);
+		}
+		for (uint32_t i = 0; i < CHECK_SOLVES; i++)
+		{
+			AI_conds world = {check_random (CHECK_STATES), CHECK_STATES - 1};
+			AI_conds goal;
+			check_literals (&goal, 3);
+			uint32_t best = check_best (mind, world, goal);
+			uint32_t result = ai_mind_solve (mind, plan, world, goal, NULL);
+			if (AI_INVALID == best && AI_INVALID == result) continue;
+			uint32_t cost = AI_INVALID;
+			if (AI_INVALID != result) cost = check_plan (plan, world, goal);
+			solves++;
+			if (cost != best) failed++;
+#ifdef AI_USE_THREADS
+			result = ai_mind_solve_parallel (mind, plan, world, goal, NULL, 4);
+			cost = AI_INVALID;
+			if (AI_INVALID != result) cost = check_plan (plan, world, goal);
+			solves++;
+			if (cost != best) failed++;
+#endif
+		}
+		ai_mind_destroy (mind);
+	}
+	ai_plan_destroy (plan);
+	printf ("Checked %u solves, %u missed the cheapest plan\n", solves, failed);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int
 main (int argc, char **argv)
 {/*Define a few recipes. Recipes get digested into mind-specific actions.
@@ -168,6 +322,12 @@ main (int argc, char **argv)
 		printf ("Failed to initialise AI library!\n");
 		return EXIT_FAILURE;
 	}
+	if (2 == argc && 0 == strcmp (argv[1], "--check"))
+	{
+		int status = check ();
+		ai_shutdown ();
+		return status;
+	}
 	/*Create a mind object and add some actions to it*/
 	AI_mind *mind = ai_mind_create ();
 	action_add (mind, &order);
@@ -178,6 +338,8 @@ main (int argc, char **argv)
 	action_add (mind, &phone);
 	action_add (mind, &call);
 	action_add (mind, &eat);
+	/*Drop actions that can never do better than another*/
+	printf ("Optimising removed %u actions\n", ai_mind_optimize (mind));
 	/*Ensure that there are flags supplied, or else print out available ones*/
 	if (argc < 2)
 	{
@@ -190,6 +352,7 @@ main (int argc, char **argv)
 		printf ("Conditions may be prefixed with - to negate them\n");
 		printf ("Use : to switch write destination to goal\n");
 		printf ("Ex. usage: is_hungry : -is_hungry\n");
+		printf ("Or --check to test the planner against random minds\n");
 		ai_mind_destroy (mind);
 		ai_shutdown ();
 		return EXIT_FAILURE;
@@ -217,13 +380,36 @@ main (int argc, char **argv)
 		else printf ("Writing condition to goal: %s\n", argv[i]);
 		ai_conds_write (dst, ai_mind_condition_get (mind, p), flag);
 	}
+	/*Capture the solve when asked to, see src/replay.c*/
+	FILE *trace = NULL;
+	if (getenv ("AI_TRACE"))
+	{
+		trace = fopen (getenv ("AI_TRACE"), "wb");
+		if (trace) ai_trace_capture (trace_write, trace);
+	}
 	/*Solve for a plan*/
 	AI_plan *plan = ai_plan_create ();
-	if (AI_INVALID == ai_mind_solve (mind, plan, world, goal, NULL))
+	uint32_t result = ai_mind_solve (mind, plan, world, goal, NULL);
+	if (trace)
+	{
+		ai_trace_capture (NULL, NULL);
+		fclose (trace);
+	}
+	if (AI_INVALID == result)
 	{
 		printf ("No plan possible!\n");
 		goto Cleanup;
 	}
+	/*Report the work the search did*/
+	AI_stats stats;
+	ai_stats_get (&stats);
+	printf ("Search expanded %llu nodes and generated %llu\n",
+		(unsigned long long)stats.expanded,
+		(unsigned long long)stats.generated);
+	double expanded = stats.expanded ? (double)stats.expanded : 1.0;
+	printf ("Actions tried per node: %.1f of %.1f\n",
+		stats.considered/expanded,
+		(stats.considered + stats.pruned)/expanded);
 	/*Execute the plan*/
 	printf ("Doing the plan...\n");
 	AI_action *action = NULL;
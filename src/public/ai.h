@@ -70,7 +70,10 @@ ai_conds_merge (AI_conds *from, AI_conds *to)
 	return u;
 }
 
-/*Plans store the result from minds*/
+/*Plans store the result from minds. The actions of a plan live in a body
+which is immutable once solved, and reference counted so that any number of
+plans may share it. Each plan only owns its position within the body, and a
+reference to the mind it was solved with*/
 #define AI_PLAN_INTERRUPTED		-1
 #define AI_PLAN_CONTINUING		0
 #define AI_PLAN_COMPLETED		1
@@ -78,65 +81,108 @@ typedef struct _AI_plan
 {
 	struct _AI_mind *mind;
 	uint32_t head;
-	uint32_t nacts, used;
-	AI_handle *acts;
+	struct _AI_plan_body *body; /*Private to the library*/
+	AI_conds world; /*Expected world at the head, for refining macros*/
+	struct _AI_plan *sub; /*Refinement of the macro at the head*/
 }AI_plan;
 
+uint32_t ai_plan_length (AI_plan *self);
 AI_action *ai_plan_action (AI_plan *self, uint32_t index);
 int ai_plan_step (AI_plan *self, void *user);
+void ai_plan_step_batch (
+	AI_plan **plans,
+	void **users,
+	uint32_t n,
+	int *results);
+bool ai_plan_validate (AI_plan *self, AI_conds world, void *user);
+/*Returns 0 when the rest of the plan still works from world, and otherwise what
+ai_mind_solve returns for the steps bridging onto the part kept, which is the
+whole plan when nothing could be kept. AI_INVALID when there is no way*/
+uint32_t ai_plan_repair (AI_plan *self, AI_conds world, void *user);
+void ai_plan_share (AI_plan *self, AI_plan *from);
 void ai_plan_reset (AI_plan *self);
 AI_plan *ai_plan_create (void);
 void ai_plan_destroy (AI_plan *self);
 
-static inline uint32_t
-ai_plan_length (AI_plan *self)
-{
-	return self->used;
-}
 static inline AI_action *
 ai_plan_action_peek (AI_plan *self)
 {
-	return ai_plan_action (self, self->used - self->head);
+	return ai_plan_action (self, ai_plan_length (self) - self->head);
 }
 
 /*Minds are the graphs defined by the conditions and actions known to it.
 In the graph the conditions are the nodes, and the actions are the 
 edges between them. It is worth noting that the edges are one to many,
 instead of one to one as in a typical graph. Minds also map conditions to the
-bits on AI_condition fields. Minds are shared state.
+bits on AI_condition fields. Minds are shared state, and reference counted so
+that plans keep the revision they were solved with alive. A mind should only
+be changed before it is shared, see AI_live for changing it afterwards.
 */
 typedef bool (*AI_precondition) (AI_action *, void *);
+typedef uint32_t (*AI_evaluate) (AI_action *, AI_conds *, void *);
 typedef int (*AI_perform) (AI_action *, void *);
+typedef void (*AI_perform_batch) (AI_action *, void **, uint32_t, int *);
 typedef struct _AI_action
 {
-	uint32_t cost;
+	uint32_t cost; /*A lower bound on the cost when evaluate is set*/
 	AI_conds entry; /*Conditions needed to enter the action*/
 	AI_conds exit; /*Conditions upon completion*/
 	AI_precondition precondition;
+	/*Optional, prices the action from the conditions of a node. Solves call
+	it once per distinct setting of the evaluated conditions*/
+	AI_evaluate evaluate;
+	AI_condition evaluated;
 	AI_perform perform;
+	AI_perform_batch perform_batch; /*Optional, performs for many users*/
+	/*Macro actions stand in for solving a goal of another mind. Their entry,
+	exit and cost summarise the sub plan, which is solved once reached*/
+	struct _AI_mind *sub;
+	AI_conds subgoal; /*In the conditions of the sub mind*/
 	const char *name;
 }AI_action;
 typedef struct _AI_mind
-{	/*List of available actions*/
+{
+	/*List of available actions*/
 	uint32_t nactions;
 	AI_action *actions;
 	/*List of known conditions*/
 	uint32_t nconds;
 	const char *conds[AI_MAX_CONDITIONS];
+	/*Identifies this revision of the mind for cached plans*/
+	uint32_t serial;
+	uint32_t ncallbacks; /*Actions whose outcome depends on the user*/
+	struct _AI_reach *reach; /*Rules out goals that can never hold*/
 }AI_mind;
 
 AI_mind *ai_mind_create (void);
-void ai_mind_destroy (AI_mind *self);
+AI_mind *ai_mind_clone (AI_mind *self);
+AI_mind *ai_mind_retain (AI_mind *self);
+void ai_mind_destroy (AI_mind *self); /*Drops a reference*/
 AI_condition ai_mind_condition_get (AI_mind *self, const char *atom);
-uint32_t ai_mind_condition_add (AI_mind *self, const char *atom);
-AI_action *ai_mind_action_get (AI_mind *self, uint32_t index);
+AI_condition ai_mind_condition_add (AI_mind *self, const char *atom);
+AI_conds ai_mind_conds_translate (AI_mind *self, AI_mind *from, AI_conds conds);
+/*Actions are read only once added, as solves cache what they find out about
+them. Changing one goes through ai_mind_action_set*/
+const AI_action *ai_mind_action_get (AI_mind *self, uint32_t index);
+void ai_mind_action_set (AI_mind *self, uint32_t index, AI_action *action);
 void ai_mind_action_add (AI_mind *self, AI_action *action);
+uint32_t ai_mind_optimize (AI_mind *self);
 uint32_t ai_mind_solve (
 	AI_mind *self,
 	AI_plan *plan,
 	AI_conds world,
 	AI_conds goal,
 	void *user);
+#ifdef AI_USE_THREADS
+uint32_t ai_mind_solve_parallel (
+	AI_mind *self,
+	AI_plan *plan,
+	AI_conds world,
+	AI_conds goal,
+	void *user,
+	uint32_t nworkers);
+#endif
+void ai_mind_cache_flush (void);
 	
 static inline uint32_t
 ai_mind_condition_length (AI_mind *self)
@@ -153,6 +199,149 @@ ai_mind_condition_atom (AI_mind *self, uint32_t index)
 	return self->conds[index];
 }
 
+/*Lives hold the current revision of a mind that is changed while in use. 
+Writers edit a clone of the current revision and publish it in one atomic 
+swap, while solves and plans carry on with the revision they acquired. Old 
+revisions are freed once the last of those lets go of them. Publishing is 
+meant for a single writer at a time*/
+typedef struct _AI_live AI_live;
+
+AI_live *ai_live_create (AI_mind *mind);
+void ai_live_destroy (AI_live *self);
+AI_mind *ai_live_acquire (AI_live *self);
+AI_mind *ai_live_edit (AI_live *self);
+void ai_live_publish (AI_live *self, AI_mind *mind);
+
+/*Schedulers spread the replanning of many agents over frames. Agents submit
+requests for their plans, with repeated requests for the same plan collapsing
+into one, and each tick solves as many as fit in its budget of microseconds.
+Requests are taken by deadline, pulled forward by their priority*/
+#define AI_SCHED_HISTOGRAM 24
+typedef void (*AI_solved) (AI_plan *, uint32_t, void *);
+typedef struct _AI_request
+{
+	AI_plan *plan;
+	AI_mind *mind;
+	AI_conds world;
+	AI_conds goal;
+	void *user;
+	uint64_t submitted, deadline; /*Microseconds*/
+	uint64_t order; /*The deadline pulled forward by priority*/
+}AI_request;
+typedef struct _AI_sched_slot
+{
+	AI_plan *plan;
+	uint32_t at;
+}AI_sched_slot;
+typedef struct _AI_sched_stats
+{
+	uint32_t depth, peak; /*Requests queued now, and at most*/
+	uint64_t submitted;
+	uint64_t coalesced; /*Submissions merged into a queued request*/
+	uint64_t solved;
+	uint64_t missed; /*Solved after their deadline*/
+	uint64_t latency[AI_SCHED_HISTOGRAM]; /*Power of two microsecond buckets*/
+}AI_sched_stats;
+typedef struct _AI_sched
+{
+	uint32_t budget;
+	uint32_t estimate; /*Running average of a solve, in microseconds*/
+	AI_solved solved;
+	uint32_t nrequests, cap;
+	AI_request *requests; /*Min heap on order*/
+	uint32_t nindex;
+	AI_sched_slot *index; /*Finds the queued request of a plan*/
+	AI_mind *solving; /*Held here so a solve that throws doesn't leak it*/
+	AI_sched_stats stats;
+}AI_sched;
+
+AI_sched *ai_sched_create (uint32_t budget, AI_solved solved);
+void ai_sched_destroy (AI_sched *self);
+void ai_sched_submit (
+	AI_sched *self,
+	AI_plan *plan,
+	AI_mind *mind,
+	AI_conds world,
+	AI_conds goal,
+	void *user,
+	uint32_t priority,
+	uint32_t deadline);
+void ai_sched_cancel (AI_sched *self, AI_plan *plan);
+uint32_t ai_sched_tick (AI_sched *self);
+
+static inline uint32_t
+ai_sched_depth (AI_sched *self)
+{
+	return self->nrequests;
+}
+
+/*Search statistics, accumulated per thread over every solve*/
+typedef struct _AI_stats
+{
+	uint64_t solves;
+	uint64_t expanded; /*Nodes taken from the open list*/
+	uint64_t generated; /*Distinct nodes created by the search*/
+	uint64_t improved; /*Nodes given a cheaper path after being found*/
+	uint64_t cached; /*Solves answered from the plan cache*/
+	uint64_t considered; /*Actions tried as edges of expanded nodes*/
+	uint64_t pruned; /*Actions skipped as irrelevant or unreachable*/
+	uint64_t rejected; /*Solves found impossible without searching*/
+	uint64_t evaluated; /*Calls made to evaluate callbacks*/
+}AI_stats;
+
+void ai_stats_get (AI_stats *stats);
+void ai_stats_reset (void);
+
+/*Traces record solves so they can be replayed away from the game, see 
+src/replay.c. While a thread captures, each call it makes to ai_mind_solve is
+handed to the sink as a solve record, preceded by a record of the mind the 
+first time it is seen. Precondition outcomes and evaluated costs are kept so
+the solve can be reproduced without its user. Records are in host byte order
+and sized in multiples of 8 bytes*/
+#define AI_TRACE_MIND			0x444e494d
+#define AI_TRACE_SOLVE			0x564c4f53
+#define AI_TRACE_PRECONDITION	1
+#define AI_TRACE_EVALUATE		2
+typedef void (*AI_trace_sink) (const void *, size_t, void *);
+typedef struct _AI_trace_mind
+{	/*Followed by each atom as a uint32_t length and its characters, ended by
+	a zero and padded, then an AI_trace_action per action*/
+	uint32_t tag, size;
+	uint32_t fingerprint;
+	uint32_t nconds, nactions;
+	uint32_t pad;
+}AI_trace_mind;
+typedef struct _AI_trace_action
+{
+	uint32_t cost;
+	uint32_t flags;
+	uint64_t entry[2], exit[2]; /*State, then enabled*/
+	uint64_t evaluated;
+}AI_trace_action;
+typedef struct _AI_trace_cost
+{
+	uint32_t act;
+	uint32_t cost;
+	uint64_t key; /*The evaluated conditions of the node*/
+}AI_trace_cost;
+typedef struct _AI_trace_solve
+{	/*Followed by the actions of the plan in order as padded uint32_t indices,
+	a bit per action of the mind set when its precondition passed, held in 
+	uint64_t words, and then the evaluated costs*/
+	uint32_t tag, size;
+	uint32_t fingerprint;
+	uint32_t result;
+	uint64_t world[2], goal[2];
+	uint64_t nanoseconds;
+	uint32_t length;
+	uint32_t nactions;
+	uint32_t nevaluated;
+	uint32_t pad;
+}AI_trace_solve;
+
+void ai_trace_capture (AI_trace_sink sink, void *data);
+uint32_t ai_mind_fingerprint (AI_mind *self);
+
 /*Error handling*/
 #define AI_ERR_NOMEM	0xdeaddead
 #define AI_ERR_MAXCONDS	0xcafeca75
@@ -1,8 +1,9 @@
 #pragma once
 
-/*Memory constraints for plans, in elements*/
-#define AI_MIN_PLAN 32
-#define AI_PLAN_GRANULARITY 16 /*Additions per resize*/
+/*Entries in the per-thread cache of solved plans. Solves that hit the cache
+copy the cached plan instead of searching again. Minds using precondition
+callbacks are never cached. Set to 0 to disable*/
+#define AI_PLAN_CACHE 64
 
 /*Memory constraints for search nodes, in elements*/
 #define AI_MIN_NODES 64
@@ -19,7 +20,50 @@
 usages this is ideal, but smaller problem sets may be faster without it*/
 #define AI_USE_MIN_HEAP 1
 
+/*Define this to use a bucket queue for the search instead. Buckets are indexed
+by cost, so this is the fastest choice when action costs are small integers.
+Costs past the last bucket share it and are scanned linearly*/
+//#define AI_USE_BUCKET_QUEUE 1
+#define AI_QUEUE_BUCKETS 128
+
+/*When set nodes of equal cost are ordered by their depth, expanding the ones
+closer to the goal first. This pays off when the heuristic is informative*/
+//#define AI_USE_TIE_BREAKING 1
+
+/*Entries in the memo of evaluated action costs kept during a solve, must be a
+power of two. Colliding entries are simply evaluated again*/
+#define AI_COST_MEMO 1024
+
+/*Scheduler settings. Each level of priority pulls a request's deadline in by
+a quantum, up to the given number of levels*/
+#define AI_SCHED_GRANULARITY 64 /*Requests added per resize*/
+#define AI_SCHED_QUANTUM 1000 /*In microseconds*/
+#define AI_SCHED_PRIORITIES 16
+
+/*When set solves only consider actions that can contribute to the goal, found
+by working backward from the goal through the actions achieving it*/
+#define AI_USE_RELEVANCE 1
+
+/*When set minds track which conditions their actions can ever change and which
+pairs of them can never hold together, so solves reject impossible goals 
+without searching. Actions that can never be entered are left out as well*/
+#define AI_USE_REACHABILITY 1
+
+/*When set solves can be captured into traces for replaying later. Threads only
+pay for a check of their capture state when not capturing. Traces remember
+this many minds per thread before writing one out again*/
+#define AI_USE_TRACE 1
+#define AI_TRACE_MINDS 16
+
 /*When set the library will use thread local storage to be thread-friendly.
 Without this set all thread state becomes global state, and execution should
 be limited to a single thread*/
 #define AI_USE_TLS 1
+
+/*Define this for ai_mind_solve_parallel, which spreads a single large search
+over several threads. Requires C11 threads, which not every libc provides*/
+//#define AI_USE_THREADS 1
+#define AI_MAX_WORKERS 16
+#define AI_PARALLEL_MAX_NODES (1<<22) /*Node limit across all workers*/
+#define AI_PARALLEL_CHUNK 4096 /*Nodes allocated at a time per worker*/
+#define AI_PARALLEL_BATCH 64 /*Nodes sent between workers at a time*/
@@ -0,0 +1,440 @@
+#include <stdio.h>
+#include <time.h>
+#include "ai/ai.h"
+#ifdef AI_USE_THREADS
+#include <threads.h>
+#endif
+
+/*Replays a trace captured with ai_trace_capture. Minds are rebuilt from the
+trace with callbacks answering as they did when captured, then every solve is
+run again over a number of threads and rounds. Results must match the trace
+exactly, and the throughput and latencies of the replay are reported. Without
+AI_USE_THREADS, and for threads that fail to start, the main thread runs the
+share of the solves itself*/
+typedef struct _Replay_mind
+{
+	uint32_t fingerprint;
+	AI_mind *mind;
+}Replay_mind;
+typedef struct _Replay_solve
+{
+	AI_trace_solve *rec;
+	AI_mind *mind;
+	uint32_t *acts;
+	uint64_t *passed;
+	AI_trace_cost *costs;
+}Replay_solve;
+typedef struct _Replay
+{
+	uint32_t nminds;
+	Replay_mind *minds;
+	uint32_t nsolves;
+	Replay_solve *solves;
+	uint32_t nthreads, rounds;
+	uint64_t *latency; /*Of every solve of every round*/
+}Replay;
+typedef struct _Replay_thread
+{
+#ifdef AI_USE_THREADS
+	thrd_t thread;
+#endif
+	bool started;
+	Replay *replay;
+	uint32_t id; /*Solves id, id + nthreads and so on are run by this*/
+	uint32_t mismatched;
+	uint64_t ran;
+}Replay_thread;
+
+static uint64_t
+replay_clock (void)
+{
+	struct timespec ts;
+	timespec_get (&ts, TIME_UTC);
+	return (uint64_t)ts.tv_sec*1000000000u + (uint64_t)ts.tv_nsec;
+}
+/*Callbacks standing in for those of the game*/
+static bool
+replay_precondition (AI_action *act, void *user)
+{
+	Replay_solve *s = user;
+	uint32_t i = (uint32_t)(act - s->mind->actions);
+	return (s->passed[i>>6]>>(i&63))&1;
+}
+static uint32_t
+replay_evaluate (AI_action *act, AI_conds *conds, void *user)
+{
+	Replay_solve *s = user;
+	uint32_t i = (uint32_t)(act - s->mind->actions);
+	uint64_t key = conds->state&act->evaluated;
+	for (uint32_t j = 0; j < s->rec->nevaluated; j++)
+	{
+		if (s->costs[j].act == i && s->costs[j].key == key)
+		{
+			return s->costs[j].cost;
+		}
+	}
+	return act->cost;
+}
+static AI_mind *
+mind_find (Replay *replay, uint32_t fingerprint)
+{
+	for (uint32_t i = 0; i < replay->nminds; i++)
+	{
+		if (replay->minds[i].fingerprint == fingerprint)
+		{
+			return replay->minds[i].mind;
+		}
+	}
+	return NULL;
+}
+static size_t
+pad8 (size_t size)
+{
+	return (size + 7)&~(size_t)7;
+}
+/*Checks the atoms and actions of a mind record fit within it*/
+static bool
+mind_valid (AI_trace_mind *rec)
+{
+	if (AI_MAX_CONDITIONS < rec->nconds)
+	{
+		return false;
+	}
+	uint8_t *p = (uint8_t *)(rec + 1);
+	uint64_t left = rec->size - sizeof (*rec);
+	for (uint32_t i = 0; i < rec->nconds; i++)
+	{
+		uint32_t len;
+		if (left < sizeof (len)) return false;
+		memcpy (&len, p, sizeof (len));
+		uint64_t step = pad8 ((uint64_t)sizeof (len) + len + 1);
+		if (left < step || p[sizeof (len) + len]) return false;
+		p += step;
+		left -= step;
+	}
+	return (uint64_t)rec->nactions*sizeof (AI_trace_action) <= left;
+}
+static bool
+mind_load (Replay *replay, AI_trace_mind *rec)
+{
+	if (!mind_valid (rec))
+	{
+		printf ("Mind %08x is malformed, skipping it\n", rec->fingerprint);
+		return false;
+	}
+	if (mind_find (replay, rec->fingerprint))
+	{
+		return true;
+	}
+	AI_mind *mind = ai_mind_create ();
+	uint8_t *p = (uint8_t *)(rec + 1);
+	for (uint32_t i = 0; i < rec->nconds; i++)
+	{
+		uint32_t len;
+		memcpy (&len, p, sizeof (len));
+		ai_mind_condition_add (mind, (const char *)p + sizeof (len));
+		p += pad8 (sizeof (len) + len + 1);
+	}
+	AI_trace_action *acts = (AI_trace_action *)p;
+	for (uint32_t i = 0; i < rec->nactions; i++)
+	{
+		AI_action action;
+		memset (&action, 0, sizeof (action));
+		action.cost = acts[i].cost;
+		action.entry.state = (AI_condition)acts[i].entry[0];
+		action.entry.enabled = (AI_condition)acts[i].entry[1];
+		action.exit.state = (AI_condition)acts[i].exit[0];
+		action.exit.enabled = (AI_condition)acts[i].exit[1];
+		action.evaluated = (AI_condition)acts[i].evaluated;
+		if (acts[i].flags&AI_TRACE_PRECONDITION) action.precondition = replay_precondition;
+		if (acts[i].flags&AI_TRACE_EVALUATE) action.evaluate = replay_evaluate;
+		action.name = "";
+		ai_mind_action_add (mind, &action);
+	}
+	if (ai_mind_fingerprint (mind) != rec->fingerprint)
+	{
+		printf ("Mind %08x doesn't match its fingerprint\n", rec->fingerprint);
+	}
+	uint32_t n = replay->nminds++;
+	replay->minds = realloc (replay->minds, replay->nminds*sizeof (Replay_mind));
+	replay->minds[n].fingerprint = rec->fingerprint;
+	replay->minds[n].mind = mind;
+	return true;
+}
+static bool
+solve_load (Replay *replay, AI_trace_solve *rec)
+{
+	AI_mind *mind = mind_find (replay, rec->fingerprint);
+	if (NULL == mind)
+	{
+		printf ("Solve refers to unknown mind %08x\n", rec->fingerprint);
+		return false;
+	}
+	/*The precondition bits are read for every action of the mind, and the plan
+	indexes into its actions*/
+	uint64_t need = sizeof (*rec)
+		+ pad8 ((uint64_t)rec->length*sizeof (uint32_t))
+		+ ((uint64_t)rec->nactions + 63)/64*sizeof (uint64_t)
+		+ (uint64_t)rec->nevaluated*sizeof (AI_trace_cost);
+	if (rec->nactions != mind->nactions || rec->size < need)
+	{
+		printf ("Solve of mind %08x is malformed, skipping it\n", rec->fingerprint);
+		return false;
+	}
+	uint8_t *p = (uint8_t *)(rec + 1);
+	Replay_solve s;
+	s.rec = rec;
+	s.mind = mind;
+	s.acts = (uint32_t *)p;
+	for (uint32_t i = 0; i < rec->length; i++)
+	{
+		if (mind->nactions <= s.acts[i])
+		{
+			printf ("Solve of mind %08x is malformed, skipping it\n", rec->fingerprint);
+			return false;
+		}
+	}
+	p += pad8 (rec->length*sizeof (uint32_t));
+	s.passed = (uint64_t *)p;
+	p += (rec->nactions + 63)/64*sizeof (uint64_t);
+	s.costs = (AI_trace_cost *)p;
+	uint32_t n = replay->nsolves++;
+	replay->solves = realloc (replay->solves, replay->nsolves*sizeof (s));
+	replay->solves[n] = s;
+	return true;
+}
+static uint8_t *
+trace_load (Replay *replay, const char *path)
+{
+	FILE *fp = fopen (path, "rb");
+	if (NULL == fp)
+	{
+		printf ("Failed to open %s\n", path);
+		return NULL;
+	}
+	fseek (fp, 0, SEEK_END);
+	long size = ftell (fp);
+	fseek (fp, 0, SEEK_SET);
+	/*Records are read in place, so keep them aligned*/
+	uint8_t *data = aligned_alloc (8, pad8 (size ? size : 1));
+	if (size != (long)fread (data, 1, size, fp))
+	{
+		printf ("Failed to read %s\n", path);
+		fclose (fp);
+		free (data);
+		return NULL;
+	}
+	fclose (fp);
+	long at = 0;
+	while (at + 8 <= size)
+	{
+		uint32_t tag = ((uint32_t *)(data + at))[0];
+		uint32_t len = ((uint32_t *)(data + at))[1];
+		/*Records are padded to 8 bytes, so the next one stays aligned*/
+		if (len < 8 || len%8 || size < at + len)
+		{
+			printf ("Trace is truncated at %ld\n", at);
+			break;
+		}
+		/*Records too short for their header are skipped like malformed ones*/
+		if (AI_TRACE_MIND == tag && sizeof (AI_trace_mind) <= len)
+		{
+			mind_load (replay, (AI_trace_mind *)(data + at));
+		}
+		else if (AI_TRACE_SOLVE == tag && sizeof (AI_trace_solve) <= len)
+		{
+			solve_load (replay, (AI_trace_solve *)(data + at));
+		}
+		else
+		{
+			printf ("Skipping record of %u bytes at %ld\n", len, at);
+		}
+		at += len;
+	}
+	return data;
+}
+/*Compares a replayed solve with the one captured*/
+static bool
+solve_matches (Replay_solve *s, AI_plan *plan, uint32_t result)
+{
+	if (result != s->rec->result)
+	{
+		return false;
+	}
+	if (AI_INVALID == result)
+	{
+		return true;
+	}
+	if (ai_plan_length (plan) != s->rec->length)
+	{
+		return false;
+	}
+	for (uint32_t i = 0; i < s->rec->length; i++)
+	{
+		if (ai_plan_action (plan, i) != s->mind->actions + s->acts[i])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+static int
+replay_run (void *arg)
+{
+	Replay_thread *t = arg;
+	Replay *replay = t->replay;
+	AI_plan *plan = ai_plan_create ();
+	for (uint32_t r = 0; r < replay->rounds; r++)
+	{
+		/*Every round starts as cold as the capture did*/
+		ai_mind_cache_flush ();
+		for (uint32_t i = t->id; i < replay->nsolves; i += replay->nthreads)
+		{
+			Replay_solve *s = &replay->solves[i];
+			AI_conds world = {(AI_condition)s->rec->world[0], (AI_condition)s->rec->world[1]};
+			AI_conds goal = {(AI_condition)s->rec->goal[0], (AI_condition)s->rec->goal[1]};
+			uint64_t start = replay_clock ();
+			uint32_t result = ai_mind_solve (s->mind, plan, world, goal, s);
+			replay->latency[r*replay->nsolves + i] = replay_clock () - start;
+			t->ran++;
+			if (!solve_matches (s, plan, result))
+			{
+				if (!t->mismatched) printf ("Solve %u differs from the trace\n", i);
+				t->mismatched++;
+			}
+		}
+	}
+	ai_plan_destroy (plan);
+	ai_mind_cache_flush ();
+	return 0;
+}
+static int
+compare_u64 (const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+static void
+print_latency (const char *what, uint64_t *ns, uint64_t n)
+{
+	if (!n)
+	{
+		return;
+	}
+	qsort (ns, n, sizeof (ns[0]), compare_u64);
+	printf ("%s latency (us): p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f\n",
+		what,
+		ns[n/2]/1000.0,
+		ns[n*9/10]/1000.0,
+		ns[n*99/100]/1000.0,
+		ns[n*999/1000]/1000.0,
+		ns[n - 1]/1000.0);
+}
+
+int
+main (int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		printf ("Usage: %s trace [threads] [rounds]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (ai_init (NULL))
+	{
+		printf ("Failed to initialise AI library!\n");
+		return EXIT_FAILURE;
+	}
+	Replay replay;
+	memset (&replay, 0, sizeof (replay));
+	replay.nthreads = argc > 2 ? (uint32_t)atoi (argv[2]) : 1;
+	replay.rounds = argc > 3 ? (uint32_t)atoi (argv[3]) : 1;
+	if (replay.nthreads < 1) replay.nthreads = 1;
+	if (replay.rounds < 1) replay.rounds = 1;
+	uint8_t *data = trace_load (&replay, argv[1]);
+	if (NULL == data)
+	{
+		ai_shutdown ();
+		return EXIT_FAILURE;
+	}
+	printf ("Loaded %u minds and %u solves\n", replay.nminds, replay.nsolves);
+	/*What the solves took when captured*/
+	uint64_t *captured = malloc ((replay.nsolves + 1)*sizeof (uint64_t));
+	uint64_t took = 0;
+	for (uint32_t i = 0; i < replay.nsolves; i++)
+	{
+		captured[i] = replay.solves[i].rec->nanoseconds;
+		took += captured[i];
+	}
+	/*Replay them. The stride of every thread is settled before any starts,
+	and the share of a thread that fails to start is run here instead*/
+	replay.latency = malloc (((uint64_t)replay.nsolves*replay.rounds + 1)*sizeof (uint64_t));
+	Replay_thread *threads = malloc (replay.nthreads*sizeof (Replay_thread));
+	for (uint32_t i = 0; i < replay.nthreads; i++)
+	{
+		threads[i].started = false;
+		threads[i].replay = &replay;
+		threads[i].id = i;
+		threads[i].mismatched = 0;
+		threads[i].ran = 0;
+	}
+	uint64_t start = replay_clock ();
+	uint32_t started = 0;
+#ifdef AI_USE_THREADS
+	for (uint32_t i = 0; i < replay.nthreads; i++)
+	{
+		if (thrd_success != thrd_create (&threads[i].thread, replay_run, &threads[i]))
+		{
+			printf ("Failed to start thread %u, running its solves on the main thread\n", i);
+			continue;
+		}
+		threads[i].started = true;
+		started++;
+	}
+#endif
+	for (uint32_t i = 0; i < replay.nthreads; i++)
+	{
+		if (!threads[i].started) replay_run (&threads[i]);
+	}
+	uint32_t mismatched = 0;
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < replay.nthreads; i++)
+	{
+#ifdef AI_USE_THREADS
+		if (threads[i].started) thrd_join (threads[i].thread, NULL);
+#endif
+		mismatched += threads[i].mismatched;
+		total += threads[i].ran;
+	}
+	double elapsed = (replay_clock () - start)/1e9;
+	/*Report*/
+	printf ("Replayed %llu solves on %u threads in %.3f s, %.0f solves/s\n",
+		(unsigned long long)total,
+		started < replay.nthreads ? started + 1 : started,
+		elapsed,
+		elapsed > 0 ? total/elapsed : 0.0);
+	if (replay.nsolves)
+	{
+		printf ("Captured solves took %.3f s, %.0f solves/s\n",
+			took/1e9,
+			took ? replay.nsolves/(took/1e9) : 0.0);
+	}
+	print_latency ("Captured", captured, replay.nsolves);
+	print_latency ("Replayed", replay.latency, total);
+	printf ("%u of %llu solves differ from the trace\n",
+		mismatched,
+		(unsigned long long)total);
+	/*Clean up everything*/
+	for (uint32_t i = 0; i < replay.nminds; i++)
+	{
+		ai_mind_destroy (replay.minds[i].mind);
+	}
+	free (threads);
+	free (replay.latency);
+	free (captured);
+	free (replay.minds);
+	free (replay.solves);
+	free (data);
+	ai_shutdown ();
+	return mismatched ? EXIT_FAILURE : EXIT_SUCCESS;
+}